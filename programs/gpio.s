@@ -0,0 +1,26 @@
+ldr r0,=0x20200004
+mov r1,#1
+lsl r1,#18
+str r1,[r0]
+mov r2,#1
+lsl r2,#16
+ldr r3,=0x2020001c
+ldr r4,=0x20200028
+mov r5,#3
+blink:
+str r2,[r3]
+mov r6,#0x10000
+on:
+sub r6,r6,#1
+cmp r6,#0
+bne on
+str r2,[r4]
+mov r6,#0x10000
+off:
+sub r6,r6,#1
+cmp r6,#0
+bne off
+sub r5,r5,#1
+cmp r5,#0
+bne blink
+andeq r0,r0,r0
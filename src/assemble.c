@@ -1,84 +1,231 @@
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include "elfWriter.h"
+#include "lexer.h"
+#include "opcodes.h"
+#include "peephole.h"
 #include "symbolTable.h"
 #include "utils.h"
 
-#define MEMORY_CAPACITY (16384)
-#define LINE_LENGTH (511)
-
-struct State {
-  char input[MEMORY_CAPACITY][LINE_LENGTH + 1];
-  uint32_t output[MEMORY_CAPACITY];
-  Node_t *symbolTable;
-  int endOfProgram;
- } state;
-
-void readFile(char *fileName) {
-  FILE *fp;
-  // Check if user has given a valid file path to program,
-  // if they have, open it as a readable file.
-  fp = fopen(fileName, "r");
-  if(fp == NULL) {
-    perror("Error opening the assembly file!\n");
+// Every source file is assembled on its own into an object, in a single
+// pass that writes each instruction as soon as it is read. Branches to
+// labels that are not defined yet are recorded as fixups. Those the file
+// resolves itself are patched once it has been read, and the rest are left
+// to the link step, which lays the objects out one after another and
+// resolves labels across files.
+//
+// Constants loaded with ldr = are collected in a literal pool, each distinct
+// value once, and the loads patched when the pool is placed. A pool goes
+// after the object's last instruction, or earlier behind a branch over it
+// when the first load waiting for it would otherwise be out of reach.
+
+struct Fixup {
+  int instNo;
+  uint32_t instBinary;
+  char *label;
+};
+
+// The furthest a load can reach past the pc, which reads 8 bytes ahead of
+// the load, with its 12 bit offset.
+#define MAX_LITERAL_REACH (4095)
+
+// The largest immediate transfer offset and constant shift amount, which
+// have 12 and 5 bit fields.
+#define MAX_OFFSET (4095)
+#define MAX_SHIFT_AMOUNT (31)
+
+// Pools never outgrow the reach of a load, so the table indexing their
+// values by hash has a fixed size of more than twice the words one can hold.
+#define POOL_INDEX_BITS (11)
+
+// A load from the pool that is not placed yet, and the slot it reads.
+struct LiteralUse {
+  int instNo;
+  uint32_t instBinary;
+  int slot;
+};
+
+// Counts of what went into an object's pools.
+struct PoolStats {
+  int pools;
+  int loads;
+  int words;
+};
+
+struct LiteralPool {
+  uint32_t *values;
+  int count;
+  int capacity;
+  struct LiteralUse *uses;
+  int useCount;
+  int useCapacity;
+  // Slot of each value plus one, or 0 for an empty entry.
+  int index[1 << POOL_INDEX_BITS];
+  struct PoolStats stats;
+};
+
+// Where a pool was placed, in words from the start of its object.
+struct PoolSpan {
+  int start;
+  int count;
+};
+
+// Constants recently encoded as Operand2, which generated code tends to
+// repeat, indexed by a hash of the value.
+#define IMMEDIATE_CACHE_BITS (6)
+
+struct CachedImmediate {
+  bool valid;
+  bool encodable;
+  uint32_t value;
+  uint32_t operand2;
+};
+
+// A source file being assembled. Its code and literal pool go to a
+// temporary file, and labels are kept as offsets from its start.
+struct Object {
+  const char *fileName;
+  FILE *code;
+  SymbolTable_t *symbolTable;
+  int instNo;
+  struct Fixup *fixups;
+  int fixupCount;
+  int fixupCapacity;
+  struct LiteralPool pool;
+  struct PoolSpan *poolSpans;
+  int poolSpanCount;
+  int poolSpanCapacity;
+  uint32_t base;
+  // Whether the object is the last file, which nothing follows into.
+  bool last;
+  struct CachedImmediate immediates[1 << IMMEDIATE_CACHE_BITS];
+};
+
+// Objects shared by the threads assembling them.
+struct Build {
+  struct Object *objects;
+  int count;
+  int next;
+  pthread_mutex_t lock;
+  // Whether the linked image goes through the peephole optimiser.
+  bool optimise;
+};
+
+// The linked program: its words, which of them are literal pool data, and
+// the address of every label.
+struct Image {
+  uint32_t *words;
+  bool *data;
+  int count;
+  SymbolTable_t *labels;
+};
+
+// Grows one of an object's arrays to hold at least one more element.
+void *reserve(void *array, int count, int *capacity, size_t size) {
+  if (count < *capacity) {
+    return array;
+  }
+  *capacity = *capacity == 0 ? 64 : *capacity * 2;
+  array = realloc(array, *capacity * size);
+  if (array == NULL) {
+    perror("Error allocating assembler state.\n");
     exit(EXIT_FAILURE);
   }
+  return array;
+}
 
-  char buffer[LINE_LENGTH + 1];
-  int lineNo = 0;
+// Records a fixup, taking ownership of the label.
+void addFixup(struct Object *object, uint32_t instBinary, char *label) {
+  object->fixups = reserve(object->fixups, object->fixupCount,
+                           &object->fixupCapacity, sizeof(struct Fixup));
+  struct Fixup *fixup = &object->fixups[object->fixupCount++];
+  fixup->instNo = object->instNo;
+  fixup->instBinary = instBinary;
+  fixup->label = label;
+}
 
-  // Read everything in the file into the state input memory.
-  while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-    buffer[strlen(buffer) - 1] = '\0';
-    strcpy(state.input[lineNo], buffer);
-    lineNo++;
+// Returns the slot of the value in the pool being collected, adding it if
+// it is not there already.
+int addLiteral(struct Object *object, uint32_t value) {
+  struct LiteralPool *pool = &object->pool;
+  uint32_t mask = (1 << POOL_INDEX_BITS) - 1;
+  uint32_t entry = (value * 2654435761u) >> (32 - POOL_INDEX_BITS);
+  for (; pool->index[entry] != 0; entry = (entry + 1) & mask) {
+    if (pool->values[pool->index[entry] - 1] == value) {
+      return pool->index[entry] - 1;
+    }
   }
-  state.input[lineNo][0] = '\0';
-  if(ferror(fp)){
-    perror("Error reading from stream.\n");
+  pool->values = reserve(pool->values, pool->count, &pool->capacity,
+                         sizeof(uint32_t));
+  pool->values[pool->count] = value;
+  pool->index[entry] = ++pool->count;
+  return pool->count - 1;
+}
+
+// Records a load of a pool slot, patched once the pool is placed.
+void addLiteralUse(struct Object *object, uint32_t instBinary, int slot) {
+  struct LiteralPool *pool = &object->pool;
+  pool->uses = reserve(pool->uses, pool->useCount, &pool->useCapacity,
+                       sizeof(struct LiteralUse));
+  pool->uses[pool->useCount++] =
+      (struct LiteralUse) {object->instNo, instBinary, slot};
+  pool->stats.loads++;
+}
+
+void syntaxError(const char *expected, const struct Token *token) {
+  if (token->type == EndToken) {
+    fprintf(stderr, "Error: expected %s at end of line.\n", expected);
+  } else {
+    fprintf(stderr, "Error: expected %s at \"%.*s\".\n", expected,
+            (int) token->length, token->text);
   }
-  fclose(fp);
+  exit(EXIT_FAILURE);
 }
 
-void writeFile(char *fileName) {
-  FILE *fp;
-  // Check if user has given a valid file path to program,
-  // if they have, open it as a readable file.
-  fp = fopen(fileName, "wb");
-  if(fp == NULL) {
-    perror("Error opening the binary file!\n");
+// Reports an operand too large for the field it goes in, as constants that
+// cannot be encoded are, rather than let its top bits be dropped.
+void checkRange(const struct Token *token, uint32_t value, uint32_t max,
+                const char *field) {
+  if (value > max) {
+    fprintf(stderr, "Error: %s %u at \"%.*s\" is larger than %u.\n", field,
+            value, (int) token->length, token->text, max);
     exit(EXIT_FAILURE);
   }
+}
 
-  fwrite(state.output, sizeof(uint32_t), state.endOfProgram, fp);
-  if(ferror(fp)){
-    perror("Error reading from stream.\n");
+uint32_t getRegister(const struct Token *token) {
+  if (token->type != RegisterToken) {
+    syntaxError("a register", token);
   }
-  fclose(fp);
+  return token->value;
 }
 
-
-void firstPass(void) {
-  int lineNo = 0;
-  state.endOfProgram = 0;
-  while(state.input[lineNo][0] != '\0') {
-    if (strchr(state.input[lineNo], ':')) {
-      char label[strlen(state.input[lineNo]) + 1];
-      strcpy(label, state.input[lineNo]);
-      push(state.symbolTable, strtok(label, ":"), state.endOfProgram * 4);
-      state.endOfProgram--;
-    }
-    lineNo++;
-    state.endOfProgram++;
+// Finds the Operand2 form of a constant, if it has one.
+bool immediateOperand(struct Object *object, uint32_t value,
+                      uint32_t *operand2) {
+  struct CachedImmediate *entry =
+      &object->immediates[(value * 2654435761u) >> (32 - IMMEDIATE_CACHE_BITS)];
+  if (!entry->valid || entry->value != value) {
+    entry->valid = true;
+    entry->value = value;
+    entry->encodable = encodeImmediate(value, &entry->operand2);
   }
+  *operand2 = entry->operand2;
+  return entry->encodable;
 }
 
-void dataProcessing(int instNo, char operands[6][20]) {
+uint32_t encodeSingleDataTransfer(struct Object *object,
+                                  const struct Token *tokens);
+
+uint32_t encodeDataProcessing(struct Object *object, const struct Token *tokens) {
   uint32_t instBinary = 0;
-  char dollarOpcode[4] = "$";
-  strcat(dollarOpcode, operands[0]);
-  uint32_t opcode = getValue(state.symbolTable, dollarOpcode);
+  struct Mnemonic mnemonic;
+  recogniseMnemonic(tokens[0].text, tokens[0].length, &mnemonic);
+  uint32_t opcode = mnemonic.opcode;
   int op2Size = 2;
 
   if (opcode >= 8 && opcode <= 10) {
@@ -87,71 +234,76 @@ void dataProcessing(int instNo, char operands[6][20]) {
     setBits(&instBinary, 1, 20, 1);
     
     // Set Rn
-    setBits(&instBinary, getRegister(operands[1]), 19, 4);
-  } else if (opcode == 13) {
+    setBits(&instBinary, getRegister(&tokens[1]), 19, 4);
+  } else if (opcode == 13 || opcode == 15) {
     // For single operand assignment
     // Set Rd
-    setBits(&instBinary, getRegister(operands[1]), 15, 4);
+    setBits(&instBinary, getRegister(&tokens[1]), 15, 4);
   } else {
     // For instructions that do not compute results
     op2Size = 3;
 
     // Set Rd
-    setBits(&instBinary, getRegister(operands[1]), 15, 4);
+    setBits(&instBinary, getRegister(&tokens[1]), 15, 4);
 
     // Set Rn
-    setBits(&instBinary, getRegister(operands[2]), 19, 4);
+    setBits(&instBinary, getRegister(&tokens[2]), 19, 4);
   }
 
-  if (operands[op2Size][0] == '#') {
+  if (tokens[op2Size].type == ImmediateToken) {
     // Operand is an expression
-    uint32_t operand2 = strtol(&operands[op2Size][1], NULL, 0);
-    bool representable = false;
-    uint32_t newRepresentation = 0;
-    int rotate = 0;
-
-    for ( ; rotate <= 30; rotate += 2) {
-      newRepresentation = rotateLeft(operand2, rotate);
-      // Check if the constant can be represented
-      if (newRepresentation == (newRepresentation & ((1 << 8) - 1))) {
-        representable = true;
-        break;
+    uint32_t value = tokens[op2Size].value;
+    uint32_t operand2;
+
+    // Constants with no Operand2 form of their own may have one inverted
+    // for mov and mvn, or negated for add and sub. Otherwise moves load
+    // them from the literal pool.
+    if (!immediateOperand(object, value, &operand2)) {
+      if ((opcode == 13 || opcode == 15) &&
+          immediateOperand(object, ~value, &operand2)) {
+        opcode = opcode == 13 ? 15 : 13;
+      } else if ((opcode == 2 || opcode == 4) &&
+                 immediateOperand(object, -value, &operand2)) {
+        opcode = opcode == 2 ? 4 : 2;
+      } else if (opcode == 13 || opcode == 15) {
+        struct Token ldr[MAX_TOKENS + 1] = {
+            {.type = IdentifierToken, .text = "ldr", .length = 3}, tokens[1],
+            {.type = LiteralToken, .value = opcode == 13 ? value : ~value}};
+        return encodeSingleDataTransfer(object, ldr);
+      } else {
+        fprintf(stderr, "Error: constant 0x%x cannot be encoded in %.*s.\n",
+                value, (int) tokens[0].length, tokens[0].text);
+        exit(EXIT_FAILURE);
       }
     }
 
-    if (!representable) {
-      perror("Immediate constant cannot be represented\n");
-      exit(EXIT_FAILURE);
-    }
-
     // Set I bit
     setBits(&instBinary, 1, 25, 1);
 
-    // Set Immediate
-    setBits(&instBinary, newRepresentation, 7, 8);
-
-    // Set Rotate
-    setBits(&instBinary, rotate / 2, 11, 4);
+    // Set Rotate and Immediate
+    setBits(&instBinary, operand2, 11, 12);
 
   } else {
     // Operand is a shifted register
     // Set Rm
-    setBits(&instBinary, getRegister(operands[op2Size]), 3, 4);
+    setBits(&instBinary, getRegister(&tokens[op2Size]), 3, 4);
 
     // Set shift type
-    if (exists(state.symbolTable, operands[op2Size+1])) {
-      setBits(&instBinary, getValue(state.symbolTable, operands[op2Size+1]), 6, 2);
+    if (tokens[op2Size+1].type == ShiftToken) {
+      setBits(&instBinary, tokens[op2Size+1].value, 6, 2);
     
-      if (operands[op2Size+2][0] == '#') {
+      if (tokens[op2Size+2].type == ImmediateToken) {
         // Shift by a constant
         // Set integer
-        setBits(&instBinary, strtol(&operands[op2Size+2][1], NULL, 0), 11, 5);
+        checkRange(&tokens[op2Size+2], tokens[op2Size+2].value,
+                   MAX_SHIFT_AMOUNT, "shift amount");
+        setBits(&instBinary, tokens[op2Size+2].value, 11, 5);
       } else {
         // Shift by a register
         setBits(&instBinary, 1, 4, 1);
 
         // Set register
-        setBits(&instBinary, getRegister(operands[op2Size+2]), 11, 4);
+        setBits(&instBinary, getRegister(&tokens[op2Size+2]), 11, 4);
       }
     }
   }
@@ -162,11 +314,13 @@ void dataProcessing(int instNo, char operands[6][20]) {
   // Set Opcode bits
   setBits(&instBinary, opcode, 24, 4);
 
-  state.output[instNo] = instBinary;
+  return instBinary;
 }
 
-void multiply(int instNo, char operands[6][20]) {
+uint32_t encodeMultiply(struct Object *object, const struct Token *tokens) {
   uint32_t instBinary = 0;
+  struct Mnemonic mnemonic;
+  recogniseMnemonic(tokens[0].text, tokens[0].length, &mnemonic);
 
   // Set conditional field
   setBits(&instBinary, 14, 31, 4);
@@ -175,98 +329,94 @@ void multiply(int instNo, char operands[6][20]) {
   setBits(&instBinary, 9, 7, 4);
 
   // Add Rd to instruction
-  setBits(&instBinary, getRegister(operands[1]), 19, 4);
+  setBits(&instBinary, getRegister(&tokens[1]), 19, 4);
 
   // Add Rm to instruction
-  setBits(&instBinary, getRegister(operands[2]), 3, 4);
+  setBits(&instBinary, getRegister(&tokens[2]), 3, 4);
 
   // Add Rs to instruction
-  setBits(&instBinary, getRegister(operands[3]), 11, 4);
+  setBits(&instBinary, getRegister(&tokens[3]), 11, 4);
 
   // Set A bit to 1 and add Rm, if instruction is mla
-  if (strcmp("mla", operands[0]) == 0) {
+  if (mnemonic.opcode == 1) {
     // Set A bit
     setBits(&instBinary, 1, 21, 1);
     // Add Rn to instruction
-    setBits(&instBinary, getRegister(operands[4]), 15, 4);
+    setBits(&instBinary, getRegister(&tokens[4]), 15, 4);
   }
 
-  state.output[instNo] = instBinary;
-
+  return instBinary;
 }
 
-// Given a number that has been tokenized, extract it and set flags
-// about whether it is a register, and the sign
-uint32_t getNumber(char *expression, bool *isRegister, bool *sign) {
-  char *endPtr = strchr(expression, ']');
-  if(endPtr) {
-    // Remove square bracket
-    expression[(int) (endPtr - expression)] = '\0';
-  }
-
-  if(strchr(expression, '-')) {
-    *sign = false;
-  } else {
-    *sign = true;
-  }
-
-  if(strchr(expression, 'r')) {
+// Given a register or number token, return its value and set flags about
+// whether it is a register, and the sign. Offsets are given as magnitudes,
+// and literals as the word they are loaded as.
+uint32_t getNumber(const struct Token *token, bool *isRegister, bool *sign) {
+  *sign = !token->negative;
+  if (token->type == RegisterToken) {
     *isRegister = true;
-    return getRegister(&expression[((!*sign) ? 1 : 0)]); 
+    return token->value;
+  }
+  if (token->type != ImmediateToken && token->type != LiteralToken) {
+    syntaxError("a register or number", token);
   }
-
   *isRegister = false;
-
-  // Shift by 1 due to #
-  int32_t num = strtol(&expression[1], NULL, 0);
-  return abs(num);
+  if (token->type == LiteralToken) {
+    return (uint32_t) token->value;
+  }
+  return token->negative ? -token->value : token->value;
 }
 
-// Given a multiplier encode expression into binary
-int32_t decodeMultiplicand(char expression[2][20], uint32_t num) {
-  char *command = expression[0];
+// Given a shift and its amount encode the shifted register num into binary
+int32_t decodeMultiplicand(const struct Token *shift, const struct Token *amount,
+                           uint32_t num) {
   bool a, b;
-  int32_t additionalOffset = getNumber(expression[1], &a, &b);
+  int32_t additionalOffset = 0;
+  if (amount->type != EndToken && amount->type != CloseToken) {
+    additionalOffset = getNumber(amount, &a, &b);
+    checkRange(amount, additionalOffset, MAX_SHIFT_AMOUNT, "shift amount");
+  }
 
-  // Return binary rep of instr + binary rep of additionalOffset + binary rep of num
+  // Return the shift amount, shift type and register num in the shifted
+  // register form of Operand2
   uint32_t offset = 0;
-  
-  if (exists(state.symbolTable, command)) {
-    setBits(&offset, getValue(state.symbolTable, command), 11, 4);
+
+  if (shift->type == ShiftToken) {
+    setBits(&offset, shift->value, 6, 2);
   }
- 
-  setBits(&offset, additionalOffset, 7, 4);
-  setBits(&offset, num, 3 , 4);
+
+  setBits(&offset, additionalOffset, 11, 5);
+  setBits(&offset, num, 3, 4);
   return offset;
 }
 
-// Translate instruction from single data processing format into data processing format
-void translateDataTransferToDataProcessing(char operands[6][20], uint32_t offset) {
-  memcpy(&operands[0], "mov", 20);
-  char expr[20];
-  strcpy(expr, "#");
-  snprintf(&expr[1], sizeof(expr), "%d", offset);
-  memcpy(&operands[2], expr, 20);
+// Returns a register or immediate offset, checking the immediate fits.
+uint32_t getOffset(const struct Token *token, bool *isRegister, bool *sign) {
+  uint32_t offset = getNumber(token, isRegister, sign);
+  if (!*isRegister) {
+    checkRange(token, offset, MAX_OFFSET, "offset");
+  }
+  return offset;
 }
 
-// Calculate the offset value based on its string representation.
+// Calculate the offset value from the tokens of the address.
 // Sets flags to say whether it is an:
 // I: Immediate offset: (shifted register / unsigned 12 bit immediate offset)
 // P: Pre/post indexing
 // U: Up bit: added to base reg / subtracted from base reg
-void calculateOffsetValue(char expression[4][20], int32_t *Rn, uint32_t *offset, bool *I, bool *P, bool *U) {
-  if(expression[0][0] == '=') { // Constant of the form <=expression>
-    *offset = getNumber(expression[0], I, U);
+void calculateOffsetValue(const struct Token *tokens, int32_t *Rn, uint32_t *offset, bool *I, bool *P, bool *U) {
+  if (tokens[0].type == LiteralToken) { // Constant of the form <=expression>
+    *offset = getNumber(&tokens[0], I, U);
     *P = true; // Add to base register before transferring data
     return;
   }
+  if (tokens[0].type != OpenToken) {
+    syntaxError("an address", &tokens[0]);
+  }
 
-  // Find index of ending square bracket
-  int range = 0;
-  for(; !strchr(expression[range], ']'); range++);
-  
   // The first argument is always going to be a register
-  *Rn = getNumber(&expression[0][1], I, U); // Offset by 1 due to '['
+  *Rn = getRegister(&tokens[1]);
+  *U = !tokens[1].negative;
 
   // Set flags
   *I = false;
@@ -274,60 +424,80 @@ void calculateOffsetValue(char expression[4][20], int32_t *Rn, uint32_t *offset,
 
   int preIndexedOffset = 0;
   int postIndexedOffset = 0;
-  
-  // Calculate offsets
-  if(expression[1][0] != '\0') {
-    if(1 <= range) { // Still within the brackets
-      preIndexedOffset = getNumber(expression[1], I, U);
-    } else { // Outside the brackets
-      postIndexedOffset = getNumber(expression[1], I, U);
-      *P = false;
+  bool inside = true;
+
+  // Calculate offsets from the operands after the base register, each of
+  // which is within the brackets if it comes before the closing one.
+  int operand = 1;
+  for (const struct Token *token = &tokens[2]; token->type != EndToken;
+       token++) {
+    if (token->type == CloseToken) {
+      inside = false;
+      continue;
     }
-  }
-  if(expression[2][0] != '\0') {
-    if(2 <= range) { // if its still within the brackets
-      preIndexedOffset = decodeMultiplicand(&expression[2], preIndexedOffset);
-    } else { // if it is outside the brackets
-      postIndexedOffset = getNumber(expression[2], I, U);
+    if (operand == 1) {
+      if (inside) {
+        preIndexedOffset = getOffset(token, I, U);
+      } else {
+        postIndexedOffset = getOffset(token, I, U);
+        *P = false;
+      }
+    } else if (operand == 2) {
+      if (inside) {
+        // A shifted register, whose amount is the next operand
+        const struct Token *amount = token + 1;
+        preIndexedOffset = decodeMultiplicand(token, amount, preIndexedOffset);
+        if (amount->type != EndToken && amount->type != CloseToken) {
+          token++;
+        }
+      } else {
+        postIndexedOffset = getOffset(token, I, U);
+      }
     }
+    operand++;
+  }
+  if (inside) {
+    syntaxError("]", &tokens[2]);
   }
 
   *offset = preIndexedOffset + postIndexedOffset;
 }
 
-void singleDataTransfer(int instNo, char operands[6][20]) {
+uint32_t encodeSingleDataTransfer(struct Object *object,
+                                  const struct Token *tokens) {
   // Initialize registers
   int32_t Rn = -1;
-  int32_t Rd = getRegister(operands[1]);
+  int32_t Rd = getRegister(&tokens[1]);
 
   // Decode instruction type:
-  bool L; // Memory to register
-  if(strcmp(operands[0], "ldr") == 0) {
-    L = true;
-  } else {
-    L = false; // i.e. register to memory
-  }
+  struct Mnemonic mnemonic;
+  recogniseMnemonic(tokens[0].text, tokens[0].length, &mnemonic);
+  bool L = mnemonic.opcode == 1; // Memory to register, or register to memory
 
   bool I, P, U;
   uint32_t offset = 0;
-
-  calculateOffsetValue(&operands[2], &Rn, &offset, &I, &P, &U);
-
-  if(offset < 0xff && L && Rn == -1) {
-    // ldr is used as a mov instruction
-    translateDataTransferToDataProcessing(operands, offset);
-    dataProcessing(instNo, operands);
-    return;
-  } else if (L && offset >= 0xffffff) {
+  int slot = -1;
+
+  calculateOffsetValue(&tokens[2], &Rn, &offset, &I, &P, &U);
+
+  uint32_t operand2;
+  if (L && Rn == -1 && (immediateOperand(object, offset, &operand2) ||
+                        immediateOperand(object, ~offset, &operand2))) {
+    // ldr is used as a mov instruction, or mvn for inverted constants
+    struct Token mov[MAX_TOKENS + 1] = {
+        {.type = IdentifierToken, .text = "mov", .length = 3}, tokens[1],
+        {.type = ImmediateToken, .value = offset}};
+    return encodeDataProcessing(object, mov);
+  } else if (L && Rn == -1) {
     // The assembler should put the value of offset in four bytes at the end of the assembled program
     // and use the address of this value with the PC as the base register and a calculated offset
 
-    // Save data at the end of assembled program
+    // Save data at the end of assembled program, whose address is only
+    // known once every instruction has been read.
     Rn = 15; // PC
     U = true;
-    state.output[state.endOfProgram] = offset;
-    offset = (state.endOfProgram - instNo) * 4 - 8;
-    state.endOfProgram++;
+    slot = addLiteral(object, offset);
+    offset = 0;
   }
 
   // Set bits
@@ -363,137 +533,441 @@ void singleDataTransfer(int instNo, char operands[6][20]) {
   // Set bits 11 - 0 to offset
   setBits(&instBinary, offset, 11, 12);  
 
-  state.output[instNo] = instBinary;
+  if (slot >= 0) {
+    addLiteralUse(object, instBinary, slot);
+  }
+  return instBinary;
 }
 
-void branch(int instNo, char operands[6][20]) {
+// Sets the offset of a branch to a label at the given address.
+void setBranchOffset(uint32_t *instBinary, int instNo, uint32_t address) {
+  int32_t offset = address - instNo * 4 - 8;
+  offset = (offset >> 2) & ((1 << 24) - 1);
+  setBits(instBinary, offset, 23, 24);
+}
+
+uint32_t encodeBranch(struct Object *object, const struct Token *tokens) {
+  uint32_t instBinary = 0;
+
   // Write condition code to instruction
-  if (strcmp(operands[0], "b") == 0) {
-    setBits(&state.output[instNo], getValue(state.symbolTable, "al"), 31, 4);
-  } else {
-    char cond[3];
-    strncpy(cond, &operands[0][1], 2);
-    cond[2] = '\0';
-    setBits(&state.output[instNo], getValue(state.symbolTable, cond), 31, 4);
-  }
+  struct Mnemonic mnemonic;
+  recogniseMnemonic(tokens[0].text, tokens[0].length, &mnemonic);
+  setBits(&instBinary, mnemonic.cond, 31, 4);
 
   // Set constant bits for all branch instruction
-  setBits(&state.output[instNo], 10, 27, 4); // 1010
+  setBits(&instBinary, 10, 27, 4); // 1010
 
-  // Calculate branch offset
-  int32_t offset = getValue(state.symbolTable, operands[1]) - instNo * 4 - 8;
-  offset = (offset >> 2) & ((1 << 24) - 1);
-  setBits(&state.output[instNo], offset, 23, 24);
+  // Calculate branch offset, later for labels not seen yet
+  const struct Token *label = &tokens[1];
+  if (label->type != IdentifierToken) {
+    syntaxError("a label", label);
+  }
+  uint32_t address;
+  if (lookup(object->symbolTable, label->text, label->length, &address)) {
+    setBranchOffset(&instBinary, object->instNo, address);
+  } else {
+    addFixup(object, instBinary, strndup(label->text, label->length));
+  }
+  return instBinary;
 }
 
-void special(int instNo, char operands[6][20]) {
-  if (strcmp(operands[0], "andeq") == 0) {
+uint32_t encodeSpecial(struct Object *object, const struct Token *tokens) {
+  struct Mnemonic mnemonic;
+  recogniseMnemonic(tokens[0].text, tokens[0].length, &mnemonic);
+  if (mnemonic.opcode == 0) {
     // andeq termination instruction
-    state.output[instNo] = 0;
+    return 0;
   } else {
     // lsl logical left shift operation passed to data processing
-    strcpy(operands[4], operands[2]);
-    strcpy(operands[3], operands[0]);
-    strcpy(operands[2], operands[1]);
-    strcpy(operands[0], "mov");
-    dataProcessing(instNo, operands);
-  }
-}
-
-void pushOpcodes() {
-  // Push opcodes into symbol table for later reference by function pointers.
-  push(state.symbolTable, "lsl", 0);
-  push(state.symbolTable, "andeq", 0);
-  push(state.symbolTable, "mul", 1);
-  push(state.symbolTable, "mla", 1);
-  push(state.symbolTable, "ldr", 2);
-  push(state.symbolTable, "str", 2);
-
-  // Push data processing opcodes into symbol table.
-  push(state.symbolTable, "$and", 0); // 0000
-  push(state.symbolTable, "$eor", 1); // 0001
-  push(state.symbolTable, "$sub", 2); // 0010
-  push(state.symbolTable, "$rsb", 3); // 0011
-  push(state.symbolTable, "$add", 4); // 0100
-  push(state.symbolTable, "$orr", 12); // 1100
-  push(state.symbolTable, "$mov", 13); // 1101
-  push(state.symbolTable, "$tst", 8); // 1000
-  push(state.symbolTable, "$teq", 9); // 1001
-  push(state.symbolTable, "$cmp", 10); // 1010
-
-  // Storing shift type into symbol table.
-  // push(state.symbolTable, "lsl", 0); // 0000 (Already in)
-  push(state.symbolTable, "lsr", 1); // 0001
-  push(state.symbolTable, "asr", 8); // 1000
-  push(state.symbolTable, "ror", 9); // 1001
-
-  // Storing condition codes in symbol table for function pointers.
-  push(state.symbolTable, "eq", 0); // 0000
-  push(state.symbolTable, "ne", 1); // 0001
-  push(state.symbolTable, "ge", 10); // 1010
-  push(state.symbolTable, "lt", 11); // 1011
-  push(state.symbolTable, "gt", 12); // 1100
-  push(state.symbolTable, "le", 13); // 1101
-  push(state.symbolTable, "al", 14); // 1110
-}
-
-void secondPass(void) {
-  // Storing opcodes and condition codes in symbol table for function pointers.
-  pushOpcodes();
-
-  int lineNo = 0;
-  int instNo = 0;
-  while(state.input[lineNo][0] != '\0') {
-    // Check not label.
-    if (strchr(state.input[lineNo], ':')) {
-      lineNo++;
+    struct Token mov[MAX_TOKENS + 1] = {
+        {.type = IdentifierToken, .text = "mov", .length = 3}, tokens[1],
+        tokens[1], {.type = ShiftToken, .text = "lsl", .length = 3},
+        tokens[2]};
+    return encodeDataProcessing(object, mov);
+  }
+}
+
+void patch(FILE *code, int instNo, uint32_t instBinary) {
+  fseek(code, instNo * sizeof(uint32_t), SEEK_SET);
+  fwrite(&instBinary, sizeof(uint32_t), 1, code);
+}
+
+// Writes the pool at the end of the object's code and patches the loads
+// waiting for it.
+void placePool(struct Object *object) {
+  struct LiteralPool *pool = &object->pool;
+  for (int i = 0; i < pool->useCount; i++) {
+    struct LiteralUse *use = &pool->uses[i];
+    // A pool right after its load is behind the pc, so the offset is down.
+    int32_t offset = (object->instNo + use->slot - use->instNo) * 4 - 8;
+    setBits(&use->instBinary, offset >= 0, 23, 1);
+    setBits(&use->instBinary, abs(offset), 11, 12);
+    patch(object->code, use->instNo, use->instBinary);
+  }
+  fseek(object->code, 0, SEEK_END);
+  if (pool->count > 0) {
+    fwrite(pool->values, sizeof(uint32_t), pool->count, object->code);
+    object->poolSpans =
+        reserve(object->poolSpans, object->poolSpanCount,
+                &object->poolSpanCapacity, sizeof(struct PoolSpan));
+    object->poolSpans[object->poolSpanCount++] =
+        (struct PoolSpan) {object->instNo, pool->count};
+    pool->stats.pools++;
+    pool->stats.words += pool->count;
+  }
+  object->instNo += pool->count;
+  pool->count = 0;
+  pool->useCount = 0;
+  memset(pool->index, 0, sizeof(pool->index));
+}
+
+// Places the pool behind a branch over it, so execution carries on past.
+void branchOverPool(struct Object *object) {
+  struct LiteralPool *pool = &object->pool;
+  uint32_t branch = 0;
+  setBits(&branch, 14, 31, 4); // al
+  setBits(&branch, 10, 27, 4); // 1010
+  setBranchOffset(&branch, object->instNo,
+                  (object->instNo + 1 + pool->count) * 4);
+  fwrite(&branch, sizeof(uint32_t), 1, object->code);
+  object->instNo++;
+  placePool(object);
+}
+
+// Places the pool before the next instruction if, left for one more, it
+// could end up out of reach of its first load.
+void placePoolIfFar(struct Object *object) {
+  struct LiteralPool *pool = &object->pool;
+  if (pool->useCount == 0 ||
+      (object->instNo + 2 + pool->count - pool->uses[0].instNo) * 4 - 8 <=
+          MAX_LITERAL_REACH) {
+    return;
+  }
+  branchOverPool(object);
+}
+
+// Assembles one line, defining the label or writing out the instruction on
+// it.
+void assembleLine(struct Object *object, char *line) {
+  char *colon = strchr(line, ':');
+  if (colon) {
+    *colon = '\0';
+    push(object->symbolTable, line, object->instNo * 4);
+    return;
+  }
+
+  struct Token tokens[MAX_TOKENS + 1];
+  if (lex(line, tokens) == 0) {
+    return;
+  }
+
+  // Function pointers to instruction types, indexed by mnemonic kind.
+  uint32_t (*instructionType[])(struct Object *, const struct Token *) = {
+      encodeSpecial, encodeMultiply, encodeSingleDataTransfer, encodeBranch,
+      encodeDataProcessing};
+
+  struct Mnemonic mnemonic;
+  if (tokens[0].type != IdentifierToken ||
+      !recogniseMnemonic(tokens[0].text, tokens[0].length, &mnemonic)) {
+    fprintf(stderr, "Error: unknown instruction \"%.*s\".\n",
+            (int) tokens[0].length, tokens[0].text);
+    exit(EXIT_FAILURE);
+  }
+  placePoolIfFar(object);
+  uint32_t instBinary = instructionType[mnemonic.kind](object, tokens);
+  fwrite(&instBinary, sizeof(uint32_t), 1, object->code);
+  object->instNo++;
+}
+
+// Places the last literal pool after the object's last instruction and
+// patches every branch waiting for a label of the object. Fixups for labels
+// from other files are kept for the link step. Execution falls through
+// into the next file, so the pool of any file but the last is branched
+// over, as it would be in one file made of them all.
+void finishObject(struct Object *object) {
+  if (!object->last && object->pool.count > 0) {
+    branchOverPool(object);
+  } else {
+    placePool(object);
+  }
+
+  int external = 0;
+  for (int i = 0; i < object->fixupCount; i++) {
+    struct Fixup *fixup = &object->fixups[i];
+    uint32_t address;
+    if (!lookup(object->symbolTable, fixup->label, strlen(fixup->label),
+                &address)) {
+      object->fixups[external++] = *fixup;
       continue;
     }
+    setBranchOffset(&fixup->instBinary, fixup->instNo, address);
+    free(fixup->label);
+    patch(object->code, fixup->instNo, fixup->instBinary);
+  }
+  object->fixupCount = external;
+}
 
-    // Assumed that max number of operands is 6, and max length of each operand is 20.
-    char operands[6][20];
-    tokenize(state.input[lineNo], operands);
+void assembleFile(struct Object *object) {
+  // Check if user has given a valid file path to program,
+  // if they have, open it as a readable file.
+  FILE *input = fopen(object->fileName, "r");
+  if (input == NULL) {
+    perror(object->fileName);
+    exit(EXIT_FAILURE);
+  }
+  object->code = tmpfile();
+  if (object->code == NULL) {
+    perror("Error creating an object file.\n");
+    exit(EXIT_FAILURE);
+  }
+  object->symbolTable = newTable();
+
+  char *line = NULL;
+  size_t length = 0;
+  ssize_t read;
+  while ((read = getline(&line, &length, input)) != -1) {
+    while (read > 0 && (line[read - 1] == '\n' || line[read - 1] == '\r')) {
+      line[--read] = '\0';
+    }
+    assembleLine(object, line);
+  }
+  free(line);
+  if (ferror(input)) {
+    perror("Error reading from stream.\n");
+  }
+  fclose(input);
+  finishObject(object);
+}
 
-    // Function pointers to instruction types with only 2 possible opcode.
-    void (*instructionType[3])(int, char[5][20]) = {special, multiply, singleDataTransfer};
-    
-    if (exists(state.symbolTable, operands[0])) {
-      instructionType[getValue(state.symbolTable, operands[0])](instNo, operands);
-    } else if (operands[0][0] == 'b') {
-      branch(instNo, operands);
-    } else {
-      dataProcessing(instNo, operands);
+// Takes source files off the list until there are none left.
+void *worker(void *argument) {
+  struct Build *build = argument;
+  while (true) {
+    pthread_mutex_lock(&build->lock);
+    int next = build->next++;
+    pthread_mutex_unlock(&build->lock);
+    if (next >= build->count) {
+      return NULL;
     }
+    assembleFile(&build->objects[next]);
+  }
+}
 
-    instNo++;
-    lineNo++;
+// Assembles every object on a pool of threads.
+void assembleObjects(struct Build *build, long threads) {
+  pthread_mutex_init(&build->lock, NULL);
+  if (threads <= 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (threads > build->count) {
+    threads = build->count;
   }
+  pthread_t *pool = malloc(threads * sizeof(pthread_t));
+  for (long i = 0; i < threads; i++) {
+    if (pthread_create(&pool[i], NULL, worker, build) != 0) {
+      perror("Error starting assembler thread.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (long i = 0; i < threads; i++) {
+    pthread_join(pool[i], NULL);
+  }
+  free(pool);
+  pthread_mutex_destroy(&build->lock);
 }
 
+// The labels of every file, and the object whose labels are being added.
+struct LabelMerge {
+  struct Build *build;
+  struct Object *object;
+  SymbolTable_t *labels;
+};
+
+// Adds a label of an object at its address in the image, reporting one
+// that an earlier file defines too.
+void mergeLabel(const Symbol_t *label, void *context) {
+  struct LabelMerge *merge = context;
+  if (exists(merge->labels, label->key)) {
+    int defining = 0;
+    while (!exists(merge->build->objects[defining].symbolTable, label->key)) {
+      defining++;
+    }
+    fprintf(stderr, "Error: label \"%s\" defined in both %s and %s.\n",
+            label->key, merge->build->objects[defining].fileName,
+            merge->object->fileName);
+    exit(EXIT_FAILURE);
+  }
+  push(merge->labels, label->key, merge->object->base + label->value);
+}
 
-int main(int argc, char **argv) {
-  // Check that the user has entered both arguments.
-  if(argc != 3) {
-    perror("You must provide one input and one output file.\n");
+// The labels at their addresses after the optimiser has moved the words.
+struct LabelMove {
+  const int *moved;
+  SymbolTable_t *labels;
+};
+
+void moveLabel(const Symbol_t *label, void *context) {
+  struct LabelMove *move = context;
+  push(move->labels, label->key, move->moved[label->value / 4] * 4);
+}
+
+// Lays the objects out in order, pools included, into one image with
+// branches between files resolved, after the peephole optimiser if it is
+// on. A label must be defined in exactly one file.
+void linkObjects(struct Build *build, struct Image *image) {
+  SymbolTable_t *labels = newTable();
+  uint32_t base = 0;
+  for (int i = 0; i < build->count; i++) {
+    struct Object *object = &build->objects[i];
+    object->base = base;
+    base += object->instNo * 4;
+    struct LabelMerge merge = {build, object, labels};
+    forEachSymbol(object->symbolTable, mergeLabel, &merge);
+  }
+
+  // The objects are read back, with their pool words marked as data.
+  image->count = base / 4;
+  image->words = malloc(image->count * sizeof(uint32_t) + 1);
+  image->data = calloc(image->count + 1, sizeof(bool));
+  if (image->words == NULL || image->data == NULL) {
+    perror("Error allocating the binary.\n");
     exit(EXIT_FAILURE);
   }
+  for (int i = 0; i < build->count; i++) {
+    struct Object *object = &build->objects[i];
+    int first = object->base / 4;
+    rewind(object->code);
+    if (fread(&image->words[first], sizeof(uint32_t), object->instNo,
+              object->code) != (size_t) object->instNo) {
+      perror("Error reading an object file.\n");
+      exit(EXIT_FAILURE);
+    }
+    for (int j = 0; j < object->poolSpanCount; j++) {
+      struct PoolSpan *span = &object->poolSpans[j];
+      memset(&image->data[first + span->start], true,
+             span->count * sizeof(bool));
+    }
+    for (int j = 0; j < object->fixupCount; j++) {
+      struct Fixup *fixup = &object->fixups[j];
+      uint32_t address;
+      if (!lookup(labels, fixup->label, strlen(fixup->label), &address)) {
+        fprintf(stderr, "Error: undefined label \"%s\" in %s.\n",
+                fixup->label, object->fileName);
+        exit(EXIT_FAILURE);
+      }
+      setBranchOffset(&fixup->instBinary, first + fixup->instNo, address);
+      image->words[first + fixup->instNo] = fixup->instBinary;
+      free(fixup->label);
+    }
+  }
 
-  readFile(argv[1]);
+  if (build->optimise) {
+    int *moved = malloc((image->count + 1) * sizeof(int));
+    if (moved == NULL) {
+      perror("Error allocating the binary.\n");
+      exit(EXIT_FAILURE);
+    }
+    image->count = optimise(image->words, image->data, image->count, moved);
+    struct LabelMove move = {moved, newTable()};
+    forEachSymbol(labels, moveLabel, &move);
+    freeTable(labels);
+    labels = move.labels;
+    free(moved);
+  }
+  image->labels = labels;
+}
 
-  // Initialize the head node of symbol table. 
-  // Head will not contain any key value pair, only pointer to next node.
-  state.symbolTable = (Node_t *) malloc(sizeof(Node_t));
+void freeObject(struct Object *object) {
+  fclose(object->code);
+  freeTable(object->symbolTable);
+  free(object->fixups);
+  free(object->pool.values);
+  free(object->pool.uses);
+  free(object->poolSpans);
+}
 
-  firstPass();
+int main(int argc, char **argv) {
+  // Any number of source files are assembled into the binary named last,
+  // on as many threads as --jobs gives, or one per core. -O turns on the
+  // peephole optimiser, --elf writes an ELF executable with the labels as
+  // its symbols instead of a flat image, and --pool-stats reports how the
+  // literal pools were laid out.
+  long threads = 0;
+  bool optimise = false;
+  bool elf = false;
+  bool poolStats = false;
+  int first = 1;
+  while (first < argc) {
+    if (argc - first > 1 && strcmp(argv[first], "--jobs") == 0) {
+      threads = strtol(argv[first + 1], NULL, 10);
+      first += 2;
+    } else if (strcmp(argv[first], "-O") == 0) {
+      optimise = true;
+      first++;
+    } else if (strcmp(argv[first], "--elf") == 0) {
+      elf = true;
+      first++;
+    } else if (strcmp(argv[first], "--pool-stats") == 0) {
+      poolStats = true;
+      first++;
+    } else {
+      break;
+    }
+  }
+  // Check that the user has entered both arguments.
+  if (argc - first < 2) {
+    perror("You must provide at least one input and one output file.\n");
+    exit(EXIT_FAILURE);
+  }
 
-  secondPass();
+  struct Build build = {.count = argc - first - 1, .optimise = optimise};
+  build.objects = calloc(build.count, sizeof(struct Object));
+  if (build.objects == NULL) {
+    perror("Error allocating objects.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < build.count; i++) {
+    build.objects[i].fileName = argv[first + i];
+  }
+  build.objects[build.count - 1].last = true;
+  assembleObjects(&build, threads);
 
-  // Output binary file name.
-  char *outputFileName = argv[2];
-  writeFile(outputFileName);
+  FILE *output = fopen(argv[argc - 1], "wb");
+  if (output == NULL) {
+    perror("Error opening the binary file!\n");
+    exit(EXIT_FAILURE);
+  }
+  struct Image image;
+  linkObjects(&build, &image);
+  if (elf) {
+    writeElf(output, image.words, image.data, image.count, image.labels);
+  } else if (image.count > 0) {
+    fwrite(image.words, sizeof(uint32_t), image.count, output);
+  }
+  free(image.words);
+  free(image.data);
+  freeTable(image.labels);
+  bool failed = ferror(output);
+  if (fclose(output) != 0 || failed) {
+    perror("Error writing the binary file.\n");
+    exit(EXIT_FAILURE);
+  }
 
-  // Free symbol table.
-  freeTable(state.symbolTable);
+  struct PoolStats total = {0};
+  for (int i = 0; i < build.count; i++) {
+    struct PoolStats *stats = &build.objects[i].pool.stats;
+    total.pools += stats->pools;
+    total.loads += stats->loads;
+    total.words += stats->words;
+    freeObject(&build.objects[i]);
+  }
+  if (poolStats) {
+    fprintf(stderr, "Literal pools: %d\nLiteral loads: %d\n"
+                    "Literal words: %d (%d bytes)\nShared loads : %d\n",
+            total.pools, total.loads, total.words, total.words * 4,
+            total.loads - total.words);
+  }
+  free(build.objects);
 
   return EXIT_SUCCESS;
 }
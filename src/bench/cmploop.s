@@ -0,0 +1,13 @@
+ldr r1,=0x1000000
+mov r2,#0
+mov r3,#0x55
+loop:
+cmp r1,r3
+tst r1,#1
+teq r1,r3
+cmp r2,r1
+add r2,r2,#1
+sub r1,r1,#1
+cmp r1,#0
+bne loop
+andeq r0,r0,r0
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Writes a synthetic program for benchmarking the assembler and emulator:
+// a loop run a given number of times over a body of randomly chosen data
+// processing instructions, ldr = literals, forward branches and multiplies,
+// in proportions given by the mix.
+//
+// The body is split over numbered source files of at most a chunk of lines
+// each, which branch from one to the next. They are assembled together in
+// order with
+//   assemble PREFIX0.s PREFIX1.s ... binary
+// and bench/run finds them the same way.
+
+#define MAX_SKIP (4)
+
+// Data registers are r0 to r9, and r12 counts the iterations left.
+#define DATA_REGISTERS (10)
+
+enum itemKind {
+  DataProcessingItem,
+  LiteralItem,
+  BranchItem,
+  MultiplyItem,
+  ITEM_KINDS
+};
+
+static const char *conditions[] = {"eq", "ne", "ge", "lt", "gt", "le", ""};
+static const char *operations[] = {"add", "sub", "rsb", "and", "eor", "orr"};
+static const char *compares[] = {"cmp", "tst", "teq"};
+
+static int reg(void) {
+  return rand() % DATA_REGISTERS;
+}
+
+static void dataProcessing(FILE *output) {
+  int rd = reg(), rn = reg(), rm = reg();
+  switch (rand() % 6) {
+    case 0:
+      fprintf(output, "mov r%d,#%d\n", rd, rand() % 256);
+      break;
+    case 1:
+      fprintf(output, "%s r%d,r%d\n", compares[rand() % 3], rn, rm);
+      break;
+    case 2:
+      fprintf(output, "%s r%d,r%d,#%d\n", operations[rand() % 6], rd, rn,
+              rand() % 256);
+      break;
+    case 3:
+      fprintf(output, "%s r%d,r%d,r%d,lsl #%d\n", operations[rand() % 6], rd,
+              rn, rm, rand() % 32);
+      break;
+    default:
+      fprintf(output, "%s r%d,r%d,r%d\n", operations[rand() % 6], rd, rn, rm);
+      break;
+  }
+}
+
+// Most literals go to the pool, and the rest are folded into moves.
+static void literal(FILE *output) {
+  unsigned value = rand() % 8 == 0 ? (unsigned) rand() % 0xff
+                                   : (unsigned) rand() << 8 | rand() % 0xff;
+  fprintf(output, "ldr r%d,=0x%x\n", reg(), value);
+}
+
+static void multiply(FILE *output) {
+  int rd = reg(), rm = reg(), rs = reg();
+  // The destination must differ from the first operand.
+  if (rm == rd) {
+    rm = (rm + 1) % DATA_REGISTERS;
+  }
+  if (rand() % 2) {
+    fprintf(output, "mla r%d,r%d,r%d,r%d\n", rd, rm, rs, reg());
+  } else {
+    fprintf(output, "mul r%d,r%d,r%d\n", rd, rm, rs);
+  }
+}
+
+// Parses a mix of the form "DP,LDR,BRANCH,MLA" into relative weights.
+static int parseMix(const char *text, int weights[ITEM_KINDS]) {
+  int total = 0;
+  for (int i = 0; i < ITEM_KINDS; i++) {
+    char *end;
+    long weight = strtol(text, &end, 10);
+    char separator = i + 1 < ITEM_KINDS ? ',' : '\0';
+    if (end == text || weight < 0 || *end != separator) {
+      return 0;
+    }
+    weights[i] = weight;
+    total += weight;
+    text = end + 1;
+  }
+  return total;
+}
+
+static void chunkName(char *fileName, size_t size, const char *prefix,
+                      int chunk) {
+  snprintf(fileName, size, "%s%d.s", prefix, chunk);
+}
+
+static FILE *openChunk(const char *prefix, int chunk) {
+  char fileName[4096];
+  chunkName(fileName, sizeof(fileName), prefix, chunk);
+  FILE *output = fopen(fileName, "w");
+  if (output == NULL) {
+    perror(fileName);
+    exit(EXIT_FAILURE);
+  }
+  return output;
+}
+
+int main(int argc, char **argv) {
+  long lines = 10000;
+  long iterations = 100;
+  long chunkLines = 256;
+  unsigned seed = 1;
+  const char *mix = "6,2,1,1";
+  const char *prefix = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--lines") == 0 && i + 1 < argc) {
+      lines = strtol(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = strtol(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--chunk") == 0 && i + 1 < argc) {
+      chunkLines = strtol(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--mix") == 0 && i + 1 < argc) {
+      mix = argv[++i];
+    } else if (prefix == NULL) {
+      prefix = argv[i];
+    } else {
+      prefix = NULL;
+      break;
+    }
+  }
+  int weights[ITEM_KINDS];
+  int total = parseMix(mix, weights);
+  if (prefix == NULL || lines <= 0 || iterations <= 0 ||
+      iterations > 0xffffffffL || chunkLines <= MAX_SKIP || total == 0) {
+    fprintf(stderr, "Usage: generate [--lines N] [--iterations N] "
+                    "[--chunk N] [--seed N] [--mix DP,LDR,BRANCH,MLA] "
+                    "PREFIX\n");
+    exit(EXIT_FAILURE);
+  }
+  srand(seed);
+
+  int chunk = 0;
+  FILE *output = openChunk(prefix, chunk);
+  // The iteration count is built a byte at a time, since every byte on its
+  // own is a valid immediate.
+  fprintf(output, "mov r12,#%ld\n", iterations & 0xff);
+  for (int shift = 8; shift < 32; shift += 8) {
+    if (iterations >> shift & 0xff) {
+      fprintf(output, "orr r12,r12,#0x%lx\n",
+              iterations & (0xffL << shift));
+    }
+  }
+  fprintf(output, "loop:\n");
+
+  // Lines left until the pending branch target, or 0 if there is none.
+  int skip = 0;
+  int label = 0;
+  long written = 0;
+  for (long i = 0; i < lines; i++) {
+    // Branch targets never cross into the next file, so it is started once
+    // no branch is pending.
+    if (written >= chunkLines && skip == 0) {
+      fprintf(output, "b chunk%d\n", chunk + 1);
+      fclose(output);
+      output = openChunk(prefix, ++chunk);
+      fprintf(output, "chunk%d:\n", chunk);
+      written = 0;
+    }
+
+    int pick = rand() % total;
+    enum itemKind kind = 0;
+    while (pick >= weights[kind]) {
+      pick -= weights[kind++];
+    }
+    if (kind == BranchItem && skip > 0) {
+      kind = DataProcessingItem;
+    }
+    switch (kind) {
+      case DataProcessingItem:
+        dataProcessing(output);
+        break;
+      case LiteralItem:
+        literal(output);
+        break;
+      case BranchItem:
+        skip = 1 + rand() % MAX_SKIP;
+        fprintf(output, "b%s skip%d\n", conditions[rand() % 7], label);
+        break;
+      default:
+        multiply(output);
+        break;
+    }
+    written++;
+
+    if (kind != BranchItem && skip > 0 && --skip == 0) {
+      fprintf(output, "skip%d:\n", label++);
+    }
+  }
+  if (skip > 0) {
+    fprintf(output, "skip%d:\n", label++);
+  }
+
+  fprintf(output, "sub r12,r12,#1\n");
+  fprintf(output, "cmp r12,#0\n");
+  fprintf(output, "bne loop\n");
+  fprintf(output, "andeq r0,r0,r0\n");
+  fclose(output);
+
+  // Files left over from a longer program would be taken as part of this
+  // one.
+  char fileName[4096];
+  do {
+    chunkName(fileName, sizeof(fileName), prefix, ++chunk);
+  } while (remove(fileName) == 0);
+  return EXIT_SUCCESS;
+}
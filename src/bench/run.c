@@ -0,0 +1,231 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Times the assembler and every emulator engine on a program written by
+// bench/generate, printing one JSON object per line for each tool: lines
+// per second for the assembler, millions of instructions per second for the
+// engines, and the peak resident set size of each. Every tool is run a
+// number of times and the fastest run is reported.
+
+#define MAX_FILES (65536)
+#define MAX_ARGUMENTS (MAX_FILES + 8)
+
+struct Result {
+  double seconds;
+  long peakKiB;
+};
+
+// Runs a command with its standard output discarded, and its standard
+// error as well unless it is read through errorOutput.
+static struct Result runCommand(char **argv, FILE **errorOutput) {
+  int pipeFds[2];
+  if (errorOutput != NULL && pipe(pipeFds) != 0) {
+    perror("Error creating a pipe.\n");
+    exit(EXIT_FAILURE);
+  }
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("Error starting a benchmark.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    FILE *null = fopen("/dev/null", "w");
+    dup2(fileno(null), STDOUT_FILENO);
+    if (errorOutput != NULL) {
+      close(pipeFds[0]);
+      dup2(pipeFds[1], STDERR_FILENO);
+    } else {
+      dup2(fileno(null), STDERR_FILENO);
+    }
+    execv(argv[0], argv);
+    _exit(127);
+  }
+
+  if (errorOutput != NULL) {
+    close(pipeFds[1]);
+    *errorOutput = fdopen(pipeFds[0], "r");
+    return (struct Result) {0};
+  }
+  int status;
+  struct rusage usage;
+  wait4(pid, &status, 0, &usage);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s failed.\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  return (struct Result) {
+      .seconds = (end.tv_sec - start.tv_sec) +
+                 (end.tv_nsec - start.tv_nsec) / 1e9,
+      .peakKiB = usage.ru_maxrss};
+}
+
+static struct Result fastest(char **argv, int repeat) {
+  struct Result best = runCommand(argv, NULL);
+  for (int i = 1; i < repeat; i++) {
+    struct Result result = runCommand(argv, NULL);
+    if (result.seconds < best.seconds) {
+      best = result;
+    }
+  }
+  return best;
+}
+
+static long countLines(const char *fileName) {
+  FILE *fp = fopen(fileName, "r");
+  if (fp == NULL) {
+    perror(fileName);
+    exit(EXIT_FAILURE);
+  }
+  long lines = 0;
+  int c;
+  while ((c = getc(fp)) != EOF) {
+    lines += c == '\n';
+  }
+  fclose(fp);
+  return lines;
+}
+
+// Counts the instructions the program executes from the emulator's profile.
+static uint64_t countInstructions(const char *emulator, const char *memory,
+                                  const char *binary) {
+  char *argv[] = {(char *) emulator, "--profile", "--memory", (char *) memory,
+                  (char *) binary, NULL};
+  FILE *profile;
+  runCommand(argv, &profile);
+  char *line = NULL;
+  size_t length = 0;
+  unsigned long long instructions = 0;
+  while (getline(&line, &length, profile) != -1) {
+    sscanf(line, "Instructions : %llu", &instructions);
+  }
+  free(line);
+  fclose(profile);
+  int status;
+  wait(&status);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || instructions == 0) {
+    fprintf(stderr, "%s --profile failed.\n", emulator);
+    exit(EXIT_FAILURE);
+  }
+  return instructions;
+}
+
+int main(int argc, char **argv) {
+  // --assembler and --emulator give the tools to time, --repeat how many
+  // times each is run and --jobs how many threads the assembler uses.
+  const char *assembler = "./assemble";
+  const char *emulator = "./emulate";
+  const char *jobs = NULL;
+  int repeat = 3;
+  const char *prefix = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--assembler") == 0 && i + 1 < argc) {
+      assembler = argv[++i];
+    } else if (strcmp(argv[i], "--emulator") == 0 && i + 1 < argc) {
+      emulator = argv[++i];
+    } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = argv[++i];
+    } else if (prefix == NULL) {
+      prefix = argv[i];
+    } else {
+      prefix = NULL;
+      break;
+    }
+  }
+  if (prefix == NULL || repeat <= 0) {
+    fprintf(stderr, "Usage: run [--assembler PATH] [--emulator PATH] "
+                    "[--repeat N] [--jobs N] PREFIX\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // The sources are PREFIX0.s, PREFIX1.s and so on, and the binary PREFIX.bin.
+  char **arguments = malloc(MAX_ARGUMENTS * sizeof(char *));
+  int count = 0;
+  arguments[count++] = (char *) assembler;
+  if (jobs != NULL) {
+    arguments[count++] = "--jobs";
+    arguments[count++] = (char *) jobs;
+  }
+  int files = 0;
+  long lines = 0;
+  while (files < MAX_FILES) {
+    char fileName[4096];
+    snprintf(fileName, sizeof(fileName), "%s%d.s", prefix, files);
+    if (access(fileName, R_OK) != 0) {
+      break;
+    }
+    lines += countLines(fileName);
+    arguments[count++] = strdup(fileName);
+    files++;
+  }
+  if (files == 0) {
+    fprintf(stderr, "%s0.s: no sources to assemble.\n", prefix);
+    exit(EXIT_FAILURE);
+  }
+  char binary[4096];
+  snprintf(binary, sizeof(binary), "%s.bin", prefix);
+  arguments[count++] = binary;
+  arguments[count] = NULL;
+
+  struct Result assembled = fastest(arguments, repeat);
+  printf("{\"tool\": \"assemble\", \"files\": %d, \"lines\": %ld, "
+         "\"seconds\": %.6f, \"lines_per_second\": %.0f, "
+         "\"peak_rss_kib\": %ld}\n",
+         files, lines, assembled.seconds, lines / assembled.seconds,
+         assembled.peakKiB);
+  fflush(stdout);
+
+  // Memory is sized to the binary, rounded up to a power of two.
+  struct stat info;
+  if (stat(binary, &info) != 0) {
+    perror(binary);
+    exit(EXIT_FAILURE);
+  }
+  uint64_t size = 65536;
+  while (size < (uint64_t) info.st_size) {
+    size *= 2;
+  }
+  char memory[32];
+  snprintf(memory, sizeof(memory), "%llu", (unsigned long long) size);
+
+  uint64_t instructions = countInstructions(emulator, memory, binary);
+  const char *engines[] = {"pipeline", "fast", "jit"};
+  const char *flags[] = {NULL, "--fast", "--jit"};
+  for (int i = 0; i < 3; i++) {
+    char *run[6];
+    int n = 0;
+    run[n++] = (char *) emulator;
+    if (flags[i] != NULL) {
+      run[n++] = (char *) flags[i];
+    }
+    run[n++] = "--memory";
+    run[n++] = memory;
+    run[n++] = binary;
+    run[n] = NULL;
+    struct Result emulated = fastest(run, repeat);
+    printf("{\"tool\": \"emulate\", \"engine\": \"%s\", "
+           "\"instructions\": %llu, \"seconds\": %.6f, \"mips\": %.2f, "
+           "\"peak_rss_kib\": %ld}\n",
+           engines[i], (unsigned long long) instructions, emulated.seconds,
+           instructions / emulated.seconds / 1e6, emulated.peakKiB);
+    fflush(stdout);
+  }
+
+  for (int i = count - files - 1; i < count - 1; i++) {
+    free(arguments[i]);
+  }
+  free(arguments);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "symbolTable.h"
+
+// Times the assembler's symbol table on a given number of generated labels:
+// every label is pushed once as the first pass does, then looked up with
+// exists() and getValue() as the second pass does for each reference.
+
+#define LOOKUPS_PER_LABEL (4)
+
+static double elapsed(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double ms = (now.tv_sec - start->tv_sec) * 1e3 +
+              (now.tv_nsec - start->tv_nsec) / 1e6;
+  *start = now;
+  return ms;
+}
+
+int main(int argc, char **argv) {
+  int labels = argc > 1 ? atoi(argv[1]) : 100000;
+  char key[32];
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  SymbolTable_t *table = newTable();
+  for (int i = 0; i < labels; i++) {
+    snprintf(key, sizeof(key), "label_%d", i);
+    push(table, key, i * 4);
+  }
+  double pushed = elapsed(&start);
+
+  uint32_t checksum = 0;
+  for (int j = 0; j < LOOKUPS_PER_LABEL; j++) {
+    for (int i = 0; i < labels; i++) {
+      // Labels are referenced in a different order to how they are defined.
+      snprintf(key, sizeof(key), "label_%d", (int) ((i * 7919L) % labels));
+      if (exists(table, key)) {
+        checksum += getValue(table, key);
+      }
+    }
+  }
+  double looked = elapsed(&start);
+  freeTable(table);
+
+  printf("labels %d push %.1f ms lookups %d %.1f ms checksum %u\n", labels,
+         pushed, labels * LOOKUPS_PER_LABEL, looked, checksum);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,178 @@
+#include <elf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "elfLoader.h"
+#include "emulate.h"
+#include "paging.h"
+
+bool isElf(FILE *fp) {
+  unsigned char magic[SELFMAG];
+  bool elf = fread(magic, 1, SELFMAG, fp) == SELFMAG &&
+             memcmp(magic, ELFMAG, SELFMAG) == 0;
+  rewind(fp);
+  return elf;
+}
+
+// Reads size bytes from offset in the file, returning NULL if they are not
+// all there.
+static void *readAt(FILE *fp, uint32_t offset, uint32_t size) {
+  void *buffer = malloc(size + 1);
+  if (buffer == NULL) {
+    perror("Error allocating the symbol table.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (fseek(fp, offset, SEEK_SET) != 0 || fread(buffer, 1, size, fp) != size) {
+    free(buffer);
+    return NULL;
+  }
+  return buffer;
+}
+
+// Orders symbols by address, and those at the same address by name.
+static int byAddress(const void *a, const void *b) {
+  const struct ElfSymbol *x = a;
+  const struct ElfSymbol *y = b;
+  if (x->address != y->address) {
+    return x->address < y->address ? -1 : 1;
+  }
+  return strcmp(x->name, y->name);
+}
+
+// Keeps the named symbols of the first symbol table, leaving out section,
+// file and mapping symbols. Executables without one just have no names.
+static void readSymbols(struct State *state, FILE *fp,
+                        const Elf32_Ehdr *header) {
+  if (header->e_shentsize != sizeof(Elf32_Shdr) || header->e_shnum == 0) {
+    return;
+  }
+  Elf32_Shdr *sections = readAt(fp, header->e_shoff,
+                                header->e_shnum * sizeof(Elf32_Shdr));
+  if (sections == NULL) {
+    return;
+  }
+  for (int i = 0; i < header->e_shnum; i++) {
+    const Elf32_Shdr *symtab = &sections[i];
+    if (symtab->sh_type != SHT_SYMTAB ||
+        symtab->sh_entsize != sizeof(Elf32_Sym) ||
+        symtab->sh_link >= header->e_shnum) {
+      continue;
+    }
+    const Elf32_Shdr *strtab = &sections[symtab->sh_link];
+    Elf32_Sym *entries = readAt(fp, symtab->sh_offset, symtab->sh_size);
+    char *names = readAt(fp, strtab->sh_offset, strtab->sh_size);
+    if (entries != NULL && names != NULL) {
+      names[strtab->sh_size] = '\0';
+      uint32_t count = symtab->sh_size / sizeof(Elf32_Sym);
+      state->symbols = malloc((count + 1) * sizeof(struct ElfSymbol));
+      if (state->symbols == NULL) {
+        perror("Error allocating the symbol table.\n");
+        exit(EXIT_FAILURE);
+      }
+      for (uint32_t j = 0; j < count; j++) {
+        const Elf32_Sym *entry = &entries[j];
+        int type = ELF32_ST_TYPE(entry->st_info);
+        if (entry->st_name == 0 || entry->st_name >= strtab->sh_size ||
+            entry->st_shndx == SHN_UNDEF || type == STT_SECTION ||
+            type == STT_FILE || names[entry->st_name] == '$') {
+          continue;
+        }
+        state->symbols[state->symbolCount++] = (struct ElfSymbol) {
+            entry->st_value, strdup(&names[entry->st_name])};
+      }
+      qsort(state->symbols, state->symbolCount, sizeof(struct ElfSymbol),
+            byAddress);
+    }
+    free(entries);
+    free(names);
+    break;
+  }
+  free(sections);
+}
+
+bool loadElf(struct State *state, FILE *fp, const char *fileName) {
+  Elf32_Ehdr header;
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      header.e_ident[EI_CLASS] != ELFCLASS32 ||
+      header.e_ident[EI_DATA] != ELFDATA2LSB || header.e_type != ET_EXEC ||
+      header.e_machine != EM_ARM ||
+      header.e_phentsize != sizeof(Elf32_Phdr)) {
+    fprintf(stderr, "%s: not a 32 bit little-endian ARM executable.\n",
+            fileName);
+    return false;
+  }
+
+  // Segments whose file offset and address are both page aligned are
+  // mapped straight from the file, as flat binaries are, and the rest are
+  // read in.
+  struct stat info;
+  bool mappable = fstat(fileno(fp), &info) == 0 && info.st_size > 0;
+  for (int i = 0; i < header.e_phnum; i++) {
+    Elf32_Phdr segment;
+    if (fseek(fp, header.e_phoff + i * sizeof(segment), SEEK_SET) != 0 ||
+        fread(&segment, sizeof(segment), 1, fp) != 1) {
+      fprintf(stderr, "%s: truncated program headers.\n", fileName);
+      return false;
+    }
+    if (segment.p_type != PT_LOAD) {
+      continue;
+    }
+    uint32_t mapped = 0;
+    if (mappable && segment.p_offset % MEMORY_PAGE_SIZE == 0 &&
+        segment.p_vaddr % MEMORY_PAGE_SIZE == 0 &&
+        segment.p_filesz >= MEMORY_PAGE_SIZE) {
+      if (state->image == NULL && !mapFile(state, fileno(fp), info.st_size)) {
+        mappable = false;
+      } else {
+        mapped = mapSegment(state, segment.p_offset, segment.p_vaddr,
+                            segment.p_filesz);
+      }
+    }
+    // The rest of the segment's memory, past what is in the file, is left
+    // zero as all of memory starts.
+    if (segment.p_filesz > segment.p_memsz ||
+        fseek(fp, segment.p_offset + mapped, SEEK_SET) != 0 ||
+        !readSegment(state, fp, segment.p_vaddr + mapped,
+                     segment.p_filesz - mapped)) {
+      fprintf(stderr, "%s: segment %d does not fit in memory.\n", fileName,
+              i);
+      return false;
+    }
+  }
+  state->registers[15] = header.e_entry;
+  readSymbols(state, fp, &header);
+  return true;
+}
+
+const char *findSymbol(const struct State *state, uint32_t address,
+                       uint32_t *offset) {
+  // The last symbol at or before the address.
+  uint32_t low = 0;
+  uint32_t high = state->symbolCount;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    if (state->symbols[middle].address <= address) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low == 0) {
+    return NULL;
+  }
+  *offset = address - state->symbols[low - 1].address;
+  return state->symbols[low - 1].name;
+}
+
+void freeSymbols(struct State *state) {
+  for (uint32_t i = 0; i < state->symbolCount; i++) {
+    free(state->symbols[i].name);
+  }
+  free(state->symbols);
+  state->symbols = NULL;
+  state->symbolCount = 0;
+}
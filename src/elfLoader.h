@@ -0,0 +1,31 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Loader for ELF32 ARM executables, such as assemble --elf writes. Only the
+// loadable segments are put in memory, each at its own address, mapped from
+// the file where they are page aligned and read in otherwise, and the
+// symbols are kept so addresses can be given names.
+
+struct State;
+
+// A named address from the symbol table of the loaded executable.
+struct ElfSymbol {
+  uint32_t address;
+  char *name;
+};
+
+// Whether a stream starts with the ELF magic number. The stream is rewound.
+bool isElf(FILE *fp);
+
+// Loads the segments of an executable into memory, which has been cleared,
+// and starts the pc at its entry point, returning false if it is not a
+// 32 bit little-endian ARM executable or does not fit in memory.
+bool loadElf(struct State *state, FILE *fp, const char *fileName);
+
+// Returns the name of the closest symbol at or before an address, storing
+// the address's offset from it, or NULL if there is none.
+const char *findSymbol(const struct State *state, uint32_t address,
+                       uint32_t *offset);
+
+void freeSymbols(struct State *state);
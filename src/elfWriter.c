@@ -0,0 +1,204 @@
+#include <elf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "elfWriter.h"
+#include "symbolTable.h"
+
+// Sections in the order their headers are written.
+enum section {
+  NullSection,
+  TextSection,
+  SymtabSection,
+  StrtabSection,
+  ShstrtabSection,
+  SECTIONS
+};
+
+// The code starts a page into the file, at the same offset within a page as
+// its address, so loaders can map it rather than read it in.
+#define PAGE_SIZE (4096)
+
+static const char sectionNames[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+
+// Offsets of the section names in sectionNames.
+static const uint32_t sectionNameOffsets[SECTIONS] = {0, 1, 7, 15, 23};
+
+// A growing array of symbols and the string table of their names.
+struct Symbols {
+  Elf32_Sym *entries;
+  uint32_t count;
+  uint32_t capacity;
+  char *names;
+  uint32_t namesSize;
+  uint32_t namesCapacity;
+};
+
+static void *grow(void *array, uint32_t *capacity, uint32_t needed,
+                  size_t size) {
+  if (needed <= *capacity) {
+    return array;
+  }
+  while (*capacity < needed) {
+    *capacity = *capacity == 0 ? 64 : *capacity * 2;
+  }
+  array = realloc(array, *capacity * size);
+  if (array == NULL) {
+    perror("Error allocating the symbol table.\n");
+    exit(EXIT_FAILURE);
+  }
+  return array;
+}
+
+static uint32_t addName(struct Symbols *symbols, const char *name) {
+  uint32_t length = strlen(name) + 1;
+  symbols->names = grow(symbols->names, &symbols->namesCapacity,
+                        symbols->namesSize + length, 1);
+  memcpy(&symbols->names[symbols->namesSize], name, length);
+  symbols->namesSize += length;
+  return symbols->namesSize - length;
+}
+
+static void addSymbol(struct Symbols *symbols, uint32_t name, uint32_t value,
+                      unsigned char binding) {
+  symbols->entries = grow(symbols->entries, &symbols->capacity,
+                          symbols->count + 1, sizeof(Elf32_Sym));
+  symbols->entries[symbols->count++] = (Elf32_Sym) {
+      .st_name = name,
+      .st_value = value,
+      .st_info = ELF32_ST_INFO(binding, STT_NOTYPE),
+      .st_shndx = name == 0 ? SHN_UNDEF : TextSection};
+}
+
+// Orders labels by address, and those at the same address by name.
+static int byAddress(const void *a, const void *b) {
+  const Symbol_t *x = *(const Symbol_t *const *) a;
+  const Symbol_t *y = *(const Symbol_t *const *) b;
+  if (x->value != y->value) {
+    return x->value < y->value ? -1 : 1;
+  }
+  return strcmp(x->key, y->key);
+}
+
+// Labels gathered from the table to be sorted.
+struct Labels {
+  const Symbol_t **sorted;
+  uint32_t count;
+};
+
+static void collectLabel(const Symbol_t *label, void *context) {
+  struct Labels *labels = context;
+  labels->sorted[labels->count++] = label;
+}
+
+void writeElf(FILE *output, const uint32_t *words, const bool *data,
+              int count, const struct SymbolTable *labels) {
+  // Local symbols come first: the null symbol, then a mapping symbol
+  // wherever the words switch between code and data.
+  struct Symbols symbols = {0};
+  addName(&symbols, "");
+  addSymbol(&symbols, 0, 0, STB_LOCAL);
+  uint32_t codeName = addName(&symbols, "$a");
+  uint32_t dataName = addName(&symbols, "$d");
+  for (int i = 0; i < count; i++) {
+    if (i == 0 || data[i] != data[i - 1]) {
+      addSymbol(&symbols, data[i] ? dataName : codeName, i * 4, STB_LOCAL);
+    }
+  }
+  uint32_t firstGlobal = symbols.count;
+
+  struct Labels gathered = {
+      malloc((labels->count + 1) * sizeof(Symbol_t *)), 0};
+  if (gathered.sorted == NULL) {
+    perror("Error allocating the symbol table.\n");
+    exit(EXIT_FAILURE);
+  }
+  forEachSymbol(labels, collectLabel, &gathered);
+  qsort(gathered.sorted, gathered.count, sizeof(Symbol_t *), byAddress);
+  for (uint32_t i = 0; i < gathered.count; i++) {
+    const Symbol_t *label = gathered.sorted[i];
+    addSymbol(&symbols, addName(&symbols, label->key), label->value,
+              STB_GLOBAL);
+  }
+  free(gathered.sorted);
+
+  // The headers are followed, a page in, by the code, the symbols, their
+  // names, the section names and last the section headers.
+  uint32_t textSize = count * sizeof(uint32_t);
+  uint32_t headersSize = sizeof(Elf32_Ehdr) + sizeof(Elf32_Phdr);
+  uint32_t textOffset = PAGE_SIZE;
+  uint32_t symtabOffset = textOffset + textSize;
+  uint32_t symtabSize = symbols.count * sizeof(Elf32_Sym);
+  uint32_t strtabOffset = symtabOffset + symtabSize;
+  uint32_t shstrtabOffset = strtabOffset + symbols.namesSize;
+  uint32_t sectionsOffset = (shstrtabOffset + sizeof(sectionNames) + 3) & ~3u;
+
+  Elf32_Ehdr header = {
+      .e_ident = {ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3, ELFCLASS32, ELFDATA2LSB,
+                  EV_CURRENT, ELFOSABI_NONE},
+      .e_type = ET_EXEC,
+      .e_machine = EM_ARM,
+      .e_version = EV_CURRENT,
+      .e_entry = 0,
+      .e_phoff = sizeof(Elf32_Ehdr),
+      .e_shoff = sectionsOffset,
+      .e_ehsize = sizeof(Elf32_Ehdr),
+      .e_phentsize = sizeof(Elf32_Phdr),
+      .e_phnum = 1,
+      .e_shentsize = sizeof(Elf32_Shdr),
+      .e_shnum = SECTIONS,
+      .e_shstrndx = ShstrtabSection};
+  // Programs may store over their own code, so the segment is writable.
+  Elf32_Phdr segment = {
+      .p_type = PT_LOAD,
+      .p_offset = textOffset,
+      .p_vaddr = 0,
+      .p_paddr = 0,
+      .p_filesz = textSize,
+      .p_memsz = textSize,
+      .p_flags = PF_R | PF_W | PF_X,
+      .p_align = PAGE_SIZE};
+  Elf32_Shdr sections[SECTIONS] = {
+      [TextSection] = {.sh_type = SHT_PROGBITS,
+                       .sh_flags = SHF_ALLOC | SHF_EXECINSTR | SHF_WRITE,
+                       .sh_offset = textOffset,
+                       .sh_size = textSize,
+                       .sh_addralign = sizeof(uint32_t)},
+      [SymtabSection] = {.sh_type = SHT_SYMTAB,
+                         .sh_offset = symtabOffset,
+                         .sh_size = symtabSize,
+                         .sh_link = StrtabSection,
+                         .sh_info = firstGlobal,
+                         .sh_addralign = sizeof(uint32_t),
+                         .sh_entsize = sizeof(Elf32_Sym)},
+      [StrtabSection] = {.sh_type = SHT_STRTAB,
+                         .sh_offset = strtabOffset,
+                         .sh_size = symbols.namesSize,
+                         .sh_addralign = 1},
+      [ShstrtabSection] = {.sh_type = SHT_STRTAB,
+                           .sh_offset = shstrtabOffset,
+                           .sh_size = sizeof(sectionNames),
+                           .sh_addralign = 1}};
+  for (int i = 0; i < SECTIONS; i++) {
+    sections[i].sh_name = sectionNameOffsets[i];
+  }
+
+  static const char padding[PAGE_SIZE] = {0};
+  fwrite(&header, sizeof(header), 1, output);
+  fwrite(&segment, sizeof(segment), 1, output);
+  fwrite(padding, 1, textOffset - headersSize, output);
+  if (count > 0) {
+    fwrite(words, sizeof(uint32_t), count, output);
+  }
+  fwrite(symbols.entries, sizeof(Elf32_Sym), symbols.count, output);
+  fwrite(symbols.names, 1, symbols.namesSize, output);
+  fwrite(sectionNames, 1, sizeof(sectionNames), output);
+  fwrite(padding, 1, sectionsOffset - shstrtabOffset - sizeof(sectionNames),
+         output);
+  fwrite(sections, sizeof(Elf32_Shdr), SECTIONS, output);
+
+  free(symbols.entries);
+  free(symbols.names);
+}
@@ -0,0 +1,16 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Writer of assembled programs as ELF32 ARM executables. The program is one
+// .text section loaded at address 0 by a single segment, with literal pools
+// marked as data inside it by $d and $a mapping symbols, as ARM tools do,
+// since they have to stay within reach of their loads. Every label becomes
+// a global symbol.
+
+struct SymbolTable;
+
+// Writes count words, of which those marked in data are literal pool words,
+// along with the labels, whose values are their addresses.
+void writeElf(FILE *output, const uint32_t *words, const bool *data,
+              int count, const struct SymbolTable *labels);
@@ -1,409 +1,313 @@
-#include <byteswap.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-#include "utils.h"
+#include "machine.h"
 
-#define MEMORY_CAPACITY (16384)
+// Command line driver for the emulator library, running a single binary or
+// a batch of them.
 
-// Enum for specifying which instruction type to execute on next cycle.
-enum decodeType {
-  DataProcessing,
-  Multiply,
-  SingleDataTransfer,
-  Branch,
-  Terminate
+#define HOT_SPOTS (20)
+
+// How every machine of a run is set up.
+struct Options {
+  enum machineEngine engine;
+  uint64_t memorySize;
+  bool gpio;
+  bool profile;
+  bool restore;
 };
 
-// Structure to define the state of the ARM machine and
-// represent the memory, registers, and instructions
-// to decode and execute on the next cycle along with the decoded type.
-struct State {
-  uint32_t memory[16384];
-  uint32_t registers[17];
-  uint32_t toDecode;
-  uint32_t toExecute;
-  enum decodeType decodedType;
-} state;
+// A binary listed in a batch manifest. Jobs without an output file of their
+// own are dumped into a buffer and printed to stdout in manifest order.
+struct Job {
+  char *binary;
+  char *outputFile;
+  char *buffer;
+  size_t size;
+  bool done;
+};
 
-void readFile(int argc, char *argv[]) {
-  // Check that the user has entered an argument.
-  if (argc != 2) {
-    perror("No binary file provided.\n");
-    exit(EXIT_FAILURE);
-  }
+// Work shared by the threads of a batch run.
+struct Batch {
+  struct Job *jobs;
+  size_t count;
+  size_t next;
+  const struct Options *options;
+  pthread_mutex_t lock;
+  pthread_cond_t finished;
+};
 
-  FILE *fp;
-  // Check if user has given a valid file path to program,
-  // if they have, open it as a readable binary file.
-  fp = fopen(argv[1], "rb");
-  if (fp == NULL) {
-    perror("Error opening the binary file!\n");
-    exit(EXIT_FAILURE);
+Machine *newMachine(const struct Options *options) {
+  Machine *machine = machine_new(options->engine);
+  machine_set_memory_size(machine, options->memorySize);
+  if (options->gpio) {
+    machine_attach_gpio(machine);
   }
-
-  // Read everything in the file into the state memory.
-  fread(state.memory, sizeof(state.memory), 1, fp);
-  if (ferror(fp)) {
-    perror("Error reading from stream.\n");
+  if (options->profile) {
+    machine_profile(machine);
   }
-  fclose(fp);
+  return machine;
 }
 
-// Fetch instruction from PC (r15).
-uint32_t fetch(void) {
-  int PC = state.registers[15] / 4;
-  return state.memory[PC];
-}
-
-void termination(void) {
-  // Output register states in decimal and hex aligned properly.
-  printf("Registers:\n");
-  for (int i = 0; i < 13; i++) {
-    printf("$%-3d: %10d (0x%08x)\n", i, state.registers[i], state.registers[i]);
-  }
-  printf("PC  : %10d (0x%08x)\n", state.registers[15], state.registers[15]);
-  printf("CPSR: %10d (0x%08x)\n", state.registers[16], state.registers[16]);
-
-  // Output Non-zero memory in hex in little endian format.
-  printf("Non-zero memory:\n");
-  for (int i = 0; i < MEMORY_CAPACITY; i++) {
-    if (state.memory[i] != 0) {
-      printf("0x%08x: 0x%08x\n", i * 4, bswap_32(state.memory[i]));
-    }
+// Loads a binary, or resumes a snapshot when running with --restore.
+bool startMachine(Machine *machine, const char *fileName,
+                  const struct Options *options) {
+  if (options->restore) {
+    return machine_restore(machine, fileName);
   }
+  return machine_load(machine, fileName);
 }
 
-enum decodeType decode(void) {
-  if (state.toDecode == 0) {
-    return Terminate;
-  } else if (bit(state.toDecode, 27)) {
-    return Branch;
-  } else if (bit(state.toDecode, 26)) {
-    return SingleDataTransfer;
-  } else if (subBinary(state.toDecode, 27, 6) == 0 &&
-             subBinary(state.toDecode, 7, 4) == 1001) {
-    return Multiply;
+void runJob(struct Batch *batch, struct Job *job) {
+  FILE *output;
+  if (job->outputFile != NULL) {
+    output = fopen(job->outputFile, "w");
   } else {
-    return DataProcessing;
+    output = open_memstream(&job->buffer, &job->size);
+  }
+  if (output == NULL) {
+    perror(job->outputFile != NULL ? job->outputFile : job->binary);
+    return;
   }
-}
-
-// Utility function to decide whether CPSR register passes condition
-bool cond(uint32_t instruction) {
-  uint32_t cpsr = state.registers[16];
-  bool v = bit(cpsr, 28);
-  bool z = bit(cpsr, 30);
-  bool n = bit(cpsr, 31);
-  uint32_t flag = subBinary(instruction, 31, 4);
 
-  switch (flag) {
-    case 0:
-      return z;
-    case 1:
-      return !z;
-    case 1010:
-      return n == v;
-    case 1011:
-      return n != v;
-    case 1100:
-      return !z && (n == v);
-    case 1101:
-      return z || (n != v);
-    case 1110:
-      return true;
-    default:
-      return false;
+  Machine *machine = newMachine(batch->options);
+  machine_set_output(machine, output);
+  if (startMachine(machine, job->binary, batch->options)) {
+    machine_run(machine);
+    machine_dump(machine, output);
+    machine_profile_report(machine, output, HOT_SPOTS);
   }
+  machine_free(machine);
+  fclose(output);
 }
 
-//  Updates N, Z and C bits of CPSR according to previous operation
-void setCPSR(uint32_t result, int cFlag) {
-  int nFlag = bit(result, 31);
-  int zFlag = result == 0;
-  uint32_t newCPSR = state.registers[16];
-  newCPSR = (newCPSR & 0x7fffffff) | (nFlag << 31);
-  newCPSR = (newCPSR & 0xbfffffff) | (zFlag << 30);
-  newCPSR = (newCPSR & 0xdfffffff) | (cFlag << 29);
-  state.registers[16] = newCPSR;
-}
+// Takes jobs off the manifest until there are none left.
+void *worker(void *argument) {
+  struct Batch *batch = argument;
+  while (true) {
+    pthread_mutex_lock(&batch->lock);
+    size_t next = batch->next++;
+    pthread_mutex_unlock(&batch->lock);
+    if (next >= batch->count) {
+      return NULL;
+    }
 
-// Returns the result of logical operations, updating CPSR if required
-uint32_t aluLogic(uint32_t result, bool set, bool carry) {
-  if (set) {
-    setCPSR(result, carry);
-  }
-  return result;
-}
+    runJob(batch, &batch->jobs[next]);
 
-// Returns the result of an addition, updating CPSR if required
-uint32_t aluAdd(int32_t op1, int32_t op2, bool set) {
-  int32_t result = op1 + op2;
-  bool carry =
-      (result < 0 && op1 > 0 && op2 > 0) || (result > 0 && op1 < 0 && op2 < 0);
-  if (set) {
-    setCPSR(result, carry);
+    pthread_mutex_lock(&batch->lock);
+    batch->jobs[next].done = true;
+    pthread_cond_broadcast(&batch->finished);
+    pthread_mutex_unlock(&batch->lock);
   }
-  return result;
 }
 
-// Returns the result of a subtraction, updating CPSR if required
-uint32_t aluSub(int32_t op1, int32_t op2, bool set) {
-  int32_t result = op1 - op2;
-  bool carry = op1 >= op2;
-  if (set) {
-    setCPSR(result, carry);
+// Reads a manifest with one "binary [output file]" entry per line. Blank
+// lines and lines starting with # are skipped.
+struct Job *readManifest(const char *fileName, size_t *count) {
+  FILE *fp = fopen(fileName, "r");
+  if (fp == NULL) {
+    perror(fileName);
+    exit(EXIT_FAILURE);
   }
-  return result;
-}
 
-// Performs arithmetic/logic operations based on opcode
-void alu(uint32_t opCode, uint32_t op1, uint32_t op2, uint32_t destReg,
-         bool set, bool carry) {
-  switch (opCode) {
-    case 0: {  // and
-      state.registers[destReg] = aluLogic(op1 & op2, set, carry);
-      break;
-    }
-    case 1: {  // eor
-      state.registers[destReg] = aluLogic(op1 ^ op2, set, carry);
-      break;
+  struct Job *jobs = NULL;
+  size_t capacity = 0;
+  char *line = NULL;
+  size_t length = 0;
+  *count = 0;
+  while (getline(&line, &length, fp) != -1) {
+    char *binary = strtok(line, " \t\r\n");
+    if (binary == NULL || binary[0] == '#') {
+      continue;
     }
-    case 10: {  // sub
-      state.registers[destReg] = aluSub(op1, op2, set);
-      break;
-    }
-    case 11: {  // rsb
-      state.registers[destReg] = aluSub(op2, op1, set);
-      break;
-    }
-    case 100: {  // add
-      state.registers[destReg] = aluAdd(op1, op2, set);
-      break;
-    }
-    case 1000: {  // tst
-      aluLogic(op1 & op2, set, carry);
-      break;
-    }
-    case 1001: {  // teq
-      aluLogic(op1 ^ op2, set, carry);
-      break;
-    }
-    case 1010: {  // cmp
-      aluSub(op1, op2, set);
-      break;
-    }
-    case 1100: {  // orr
-      state.registers[destReg] = aluLogic(op1 | op2, set, carry);
-      break;
-    }
-    case 1101: {  // mov
-      state.registers[destReg] = op2;
+    char *outputFile = strtok(NULL, " \t\r\n");
+
+    if (*count == capacity) {
+      capacity = capacity == 0 ? 16 : capacity * 2;
+      jobs = realloc(jobs, capacity * sizeof(struct Job));
+      if (jobs == NULL) {
+        perror("Error allocating batch jobs.\n");
+        exit(EXIT_FAILURE);
+      }
     }
+    struct Job *job = &jobs[(*count)++];
+    memset(job, 0, sizeof(struct Job));
+    job->binary = strdup(binary);
+    job->outputFile = outputFile != NULL ? strdup(outputFile) : NULL;
   }
+  free(line);
+  fclose(fp);
+  return jobs;
 }
 
-void dataProcessing(void) {
-  // Gets the Immediate Operand & Set Condition Code bits
-  bool i = bit(state.toExecute, 25);
-  bool s = bit(state.toExecute, 20);
-
-  // Gets the Opcode, Operand1 and Destination Register
-  uint32_t opCode = subBinary(state.toExecute, 24, 4);
-  uint32_t op1 = state.registers[subByte(state.toExecute, 19, 4)];
-  uint32_t regd = subByte(state.toExecute, 15, 4);
-
-  uint32_t contents, shiftAmount, shiftType;
-
-  if (i) {  // Operand2 is an immediate value
-    contents = subByte(state.toExecute, 7, 8);
-    shiftAmount = 2 * subByte(state.toExecute, 11, 4);
-    shiftType = 3;
-  } else {  // Operand2 is a register
-    // Gets contents of Register M
-    contents = state.registers[subByte(state.toExecute, 3, 4)];
-    shiftType = subByte(state.toExecute, 6, 2);
-
-    if (bit(state.toExecute,
-            4)) {  // Shift Register M by first byte stored in Register S
-      uint32_t regsVal = state.registers[subByte(state.toExecute, 11, 4)];
-      shiftAmount = subByte(regsVal, 7, 8);
-    } else {  // Shift Register M by a constant amount
-      shiftAmount = subByte(state.toExecute, 11, 5);
+// Runs every binary in a manifest on a pool of threads, each with its own
+// machine, printing the combined stream as soon as it is next in order.
+void runBatch(const char *manifest, long threads,
+              const struct Options *options) {
+  struct Batch batch = {.options = options};
+  batch.jobs = readManifest(manifest, &batch.count);
+  pthread_mutex_init(&batch.lock, NULL);
+  pthread_cond_init(&batch.finished, NULL);
+
+  if (threads <= 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if ((size_t)threads > batch.count) {
+    threads = batch.count;
+  }
+  pthread_t *pool = malloc(threads * sizeof(pthread_t));
+  for (long i = 0; i < threads; i++) {
+    if (pthread_create(&pool[i], NULL, worker, &batch) != 0) {
+      perror("Error starting batch thread.\n");
+      exit(EXIT_FAILURE);
     }
   }
 
-  // Gets the shifted Operand2 and 'barrel shifter' Carry bit
-  uint32_t op2 = shift(contents, shiftAmount, shiftType);
-  bool c = carryOut(contents, shiftAmount, shiftType);
-
-  // Performs specified operation on operands
-  alu(opCode, op1, op2, regd, s, c);
-}
-
-void multiply(void) {
-  // Gets the index of the registers based on the instruction.
-  uint32_t regd = subByte(state.toExecute, 19, 4);
-  uint32_t regm = subByte(state.toExecute, 3, 4);
-  uint32_t regs = subByte(state.toExecute, 11, 4);
+  for (size_t i = 0; i < batch.count; i++) {
+    struct Job *job = &batch.jobs[i];
+    pthread_mutex_lock(&batch.lock);
+    while (!job->done) {
+      pthread_cond_wait(&batch.finished, &batch.lock);
+    }
+    pthread_mutex_unlock(&batch.lock);
 
-  // If accumulate is set then multiply and accumulate
-  // else just multiply.
-  state.registers[regd] = state.registers[regm] * state.registers[regs];
-  if (bit(state.toExecute, 21)) {
-    uint32_t regn = subByte(state.toExecute, 15, 4);
-    state.registers[regd] += state.registers[regn];
+    if (job->outputFile == NULL) {
+      printf("==> %s <==\n", job->binary);
+      fwrite(job->buffer, 1, job->size, stdout);
+      fflush(stdout);
+    }
+    free(job->buffer);
+    free(job->binary);
+    free(job->outputFile);
   }
-  setCPSR(state.registers[regd], bit(state.registers[16], 29));
-}
-
-// Utility function to access 4 bytes from memory at given address.
-uint32_t access(uint32_t address) {
-  return *(int *)(((char *)&state.memory) + address);
-}
 
-// Utility function to store 4 bytes of data to memory at given address.
-void store(uint32_t address, uint32_t data) {
-  memcpy(((char *)&state.memory) + address, &data, 4);
+  for (long i = 0; i < threads; i++) {
+    pthread_join(pool[i], NULL);
+  }
+  free(pool);
+  free(batch.jobs);
+  pthread_mutex_destroy(&batch.lock);
+  pthread_cond_destroy(&batch.finished);
 }
 
-bool checkMemoryInBounds(uint32_t address) {
-  if (address / 4 <= MEMORY_CAPACITY) {
-    return true;
-  } else {
-    printf("Error: Out of bounds memory access at address 0x%08x\n", address);
-    return false;
+// Parses a size in bytes with an optional K, M or G suffix, returning 0 if
+// it is malformed.
+uint64_t parseSize(const char *text) {
+  char *end;
+  uint64_t size = strtoull(text, &end, 0);
+  switch (*end) {
+    case 'G':
+    case 'g':
+      size <<= 10;
+      // fall through
+    case 'M':
+    case 'm':
+      size <<= 10;
+      // fall through
+    case 'K':
+    case 'k':
+      size <<= 10;
+      end++;
+      break;
   }
+  return *end == '\0' ? size : 0;
 }
 
-void transferData(bool mode, uint32_t source, uint32_t destination,
-                  int32_t offset) {
-  // given a mode it either:
-  // true: loads the word from memory
-  // false: stores into memory
-  if (mode) {
-    // the word is loaded from memory
-    // check for valid memory range
-    uint32_t address = state.registers[source] + offset;
-    if (checkMemoryInBounds(address)) {
-      state.registers[destination] = access(address);
-    }
-  } else {
-    // the word is stored into memory
-    if (checkMemoryInBounds((state.registers[source] + offset) / 4)) {
-      // state.memory[(state.registers[source] + offset) / 4] =
-      // state.registers[destination];
-      store(state.registers[source] + offset, state.registers[destination]);
+int main(int argc, char *argv[]) {
+  // The engine is picked with --fast for threaded code or --jit for host
+  // code, and the size of memory with --memory. --gpio maps the GPIO
+  // controller and logs its pins, and --profile reports where the program
+  // spent its time. --snapshot N FILE saves the machine after N cycles and
+  // carries on, and --restore resumes from snapshots instead of binaries.
+  // --trace FILE records every instruction of a single run for tracedump,
+  // or only the last N with --trace-ring N as well.
+  // Either a binary file or --batch with a manifest of them is needed.
+  struct Options options = {.engine = PipelineEngine,
+                            .memorySize = MACHINE_DEFAULT_MEMORY};
+  const char *manifest = NULL;
+  const char *binary = NULL;
+  const char *snapshot = NULL;
+  uint64_t snapshotCycles = 0;
+  const char *trace = NULL;
+  uint64_t traceRing = 0;
+  long threads = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--fast") == 0) {
+      options.engine = FastEngine;
+    } else if (strcmp(argv[i], "--jit") == 0) {
+      options.engine = JitEngine;
+    } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      manifest = argv[++i];
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      threads = strtol(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--gpio") == 0) {
+      options.gpio = true;
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      options.profile = true;
+    } else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+      options.memorySize = parseSize(argv[++i]);
+    } else if (strcmp(argv[i], "--snapshot") == 0 && i + 2 < argc) {
+      snapshotCycles = strtoull(argv[++i], NULL, 0);
+      snapshot = argv[++i];
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace = argv[++i];
+    } else if (strcmp(argv[i], "--trace-ring") == 0 && i + 1 < argc) {
+      traceRing = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--restore") == 0) {
+      options.restore = true;
+    } else if (binary == NULL) {
+      binary = argv[i];
+    } else {
+      binary = NULL;
+      break;
     }
   }
-}
-
-int getShiftAmount(uint32_t instruction) {
-  uint32_t shiftType = subByte(instruction, 6, 2);
-  uint32_t regm = subByte(instruction, 3, 4);
-  uint32_t shiftAmount;
-
-  if (bit(instruction, 4)) {
-    //  Shift Register M by a value stored in a register
-    uint32_t regs = subByte(instruction, 11, 4);
-    uint32_t regsValue = state.registers[regs];
-    shiftAmount = subByte(regsValue, 7, 8);
-  } else {
-    //  Shift Register M by a constant amount
-    shiftAmount = subByte(instruction, 11, 5);
+  if ((binary == NULL) == (manifest == NULL)) {
+    perror("No binary file provided.\n");
+    exit(EXIT_FAILURE);
   }
-
-  uint32_t regmVal = state.registers[regm];
-  return shift(regmVal, shiftAmount, shiftType);
-}
-
-void singleDataTransfer() {
-  // Pre: the condition has been met and the current instruction
-  //      has been identified by the parent as a singleDataTransfer
-  //      as well as wellfoundness of the command
-
-  bool I = bit(state.toExecute, 25);
-  bool P = bit(state.toExecute, 24);
-  bool U = bit(state.toExecute, 23);
-  bool L = bit(state.toExecute, 20);
-
-  uint32_t Rn = subByte(state.toExecute, 19, 4);
-  uint32_t Rd = subByte(state.toExecute, 15, 4);
-
-  uint32_t offset = subByte(state.toExecute, 11, 12);
-
-  if (I) {
-    // Offset is interpreted as a shifted register
-    offset = getShiftAmount(state.toExecute);
+  if (options.memorySize == 0 || options.memorySize > MACHINE_MAX_MEMORY) {
+    fprintf(stderr, "Memory size must be between 1 byte and 4 GiB.\n");
+    exit(EXIT_FAILURE);
   }
 
-  // NB: pre indexing will not change the value of the base register, however,
-  // post-indexing will change the contents of the base register by the offset
-  if (P) {
-    // (pre - indexing) the offset is added/subtracted to the base register
-    // before transferring the data
-    transferData(L, Rn, Rd, (U ? 1 : -1) * offset);
-  } else {
-    // the offset is added/subtracted to the base register after transferring.
-    transferData(L, Rn, Rd, 0);
-    state.registers[Rn] += (U ? 1 : -1) * offset;
+  if (manifest != NULL && trace != NULL) {
+    fprintf(stderr, "A trace needs a single binary.\n");
+    exit(EXIT_FAILURE);
   }
-}
-
-void branch(void) {
-  int32_t offset = subByte(state.toExecute, 23, 24) << 2;
-  offset |= bit(state.toExecute, 23) * 0xfc000000;
-  state.registers[15] += offset;
-}
-
-void execute(void) {
-  // Delegate to each execution function depending on decodedType.
-  if (cond(state.toExecute)) {
-    void (*instructionType[5])(void) = {
-        dataProcessing, multiply, singleDataTransfer, branch, termination};
-    instructionType[state.decodedType]();
+  if (manifest != NULL && snapshot != NULL) {
+    fprintf(stderr, "A snapshot needs a single binary.\n");
+    exit(EXIT_FAILURE);
   }
-}
 
-int main(int argc, char *argv[]) {
-  // Initialise state pointers to null
-  state.toDecode = 0xffffffff;
-  state.toExecute = 0xffffffff;
-
-  // Read binary file to state memory
-  readFile(argc, argv);
-
-  // Process next cycle until termination
-  while (state.decodedType != Terminate) {
-    // Fetch Stage
-    uint32_t newFetched = fetch();
-    // Decode Stage
-    enum decodeType newDecodedType = 0;
-    if (state.toDecode != 0xffffffff) {
-      newDecodedType = decode();
-    }
-    // Execute Stage
-    if (state.toExecute != 0xffffffff) {
-      execute();
-    }
+  if (manifest != NULL) {
+    runBatch(manifest, threads, &options);
+    return EXIT_SUCCESS;
+  }
 
-    // Update state values for next cycle and free executed instruction string.
-    // Clear fetch decode pipeline if branch instruction is executed.
-    if (state.decodedType == Branch && cond(state.toExecute)) {
-      state.toDecode = state.toExecute = 0xffffffff;
-      state.decodedType = 0;
-    } else {
-      state.toExecute = state.toDecode;
-      state.toDecode = newFetched;
-      state.decodedType = newDecodedType;
-      // Increment PC by 4 only if not branch.
-      state.registers[15] += 4;
+  // Read binary file to machine memory and run it until termination
+  // The profile goes to stderr so the dump is unchanged.
+  Machine *machine = newMachine(&options);
+  if (!startMachine(machine, binary, &options)) {
+    exit(EXIT_FAILURE);
+  }
+  if (trace != NULL && !machine_trace(machine, trace, traceRing)) {
+    exit(EXIT_FAILURE);
+  }
+  if (snapshot != NULL) {
+    machine_step(machine, snapshotCycles);
+    if (!machine_save(machine, snapshot)) {
+      exit(EXIT_FAILURE);
     }
   }
-
-  termination();
+  machine_run(machine);
+  machine_dump(machine, stdout);
+  machine_profile_report(machine, stderr, HOT_SPOTS);
+  machine_free(machine);
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,197 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define MEMORY_PAGE_BITS (12)
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_BITS)
+// Each second-level page table maps 4 MiB, and the directory of them maps
+// the full 32-bit address space.
+#define PAGE_TABLE_BITS (10)
+#define PAGE_TABLE_SIZE (1 << PAGE_TABLE_BITS)
+#define PAGE_TABLE_SHIFT (MEMORY_PAGE_BITS + PAGE_TABLE_BITS)
+#define DIRECTORY_SIZE (1 << (32 - PAGE_TABLE_SHIFT))
+#define MAX_DEVICES (8)
+#define MAX_BLOCK_LENGTH (64)
+#define EMPTY_LATCH (0xffffffff)
+
+// Enum for specifying which instruction type to execute on next cycle.
+enum decodeType {
+  DataProcessing,
+  Multiply,
+  SingleDataTransfer,
+  Branch,
+  Terminate
+};
+
+// Enum for the resolved form of operand 2 (or the transfer offset).
+enum operandForm {
+  Immediate,
+  ShiftedByConstant,
+  ShiftedByRegister
+};
+
+struct State;
+
+// Predecoded form of an instruction word. Filled in the first time its
+// address is fetched and reused on every later fetch of that address,
+// until a store to the word invalidates it.
+struct Instruction {
+  bool valid;
+  uint32_t word;
+  enum decodeType type;
+  uint32_t cond;
+  uint32_t opCode;
+  bool setFlags;
+  bool accumulate;
+  bool preIndexed;
+  bool up;
+  bool load;
+  uint32_t rn;
+  uint32_t rd;
+  uint32_t rs;
+  uint32_t rm;
+  enum operandForm form;
+  uint32_t shiftType;
+  uint32_t shiftAmount;
+  uint32_t operand2;
+  bool carry;
+  // Set when operand 2 is not shifted or rotated, so the shifter leaves the
+  // carry flag as it was.
+  bool keepsCarry;
+  int32_t offset;
+  void (*handler)(struct State *, const struct Instruction *);
+};
+
+// Enum for the kind of operation that last set the flags, or Materialised
+// once they have been written into the CPSR.
+enum flagSource {
+  Materialised,
+  Logic,
+  Addition,
+  Subtraction
+};
+
+// The last flag-setting operation and its operands. N, Z and C are only
+// worked out from these when a condition or the final dump reads them.
+struct Flags {
+  enum flagSource source;
+  int32_t result;
+  int32_t op1;
+  int32_t op2;
+  bool carry;
+};
+
+// A threaded-code operation: a predecoded instruction together with the
+// value r15 reads as while it executes (its address plus 8).
+struct Op {
+  struct Instruction instruction;
+  uint32_t pc;
+};
+
+// A basic block translated for the fast engine. Blocks end at a branch,
+// a store, the halt instruction or an instruction the engine cannot run,
+// and link directly to their successors once these have been looked up.
+// Blocks compiled by the JIT also point at their host code.
+struct Block {
+  uint32_t start;
+  uint32_t end;
+  uint32_t length;
+  bool halts;
+  struct Op ops[MAX_BLOCK_LENGTH];
+  struct Block *fallthrough;
+  struct Block *taken;
+  bool (*code)(struct State *);
+};
+
+// Predecoded entries and translated blocks for the words of a page,
+// allocated the first time the page is executed from.
+struct CodePage {
+  struct Instruction cache[MEMORY_PAGE_SIZE / 4];
+  struct Block *blocks[MEMORY_PAGE_SIZE / 4];
+  bool translated[MEMORY_PAGE_SIZE / 4];
+  // Starts whose first instruction the fast engine cannot run, so they are
+  // not translated again until the blocks are flushed.
+  bool untranslatable[MEMORY_PAGE_SIZE / 4];
+};
+
+// A memory-mapped device covering whole pages from base. Loads and stores
+// in its range go to its callbacks, with their offset from base, instead of
+// to memory.
+struct Device {
+  uint32_t base;
+  uint32_t size;
+  uint32_t (*read)(struct State *, void *, uint32_t);
+  void (*write)(struct State *, void *, uint32_t, uint32_t);
+  void *context;
+};
+
+// A page of guest memory. Its data is NULL until it is loaded or written,
+// so the pages with data are the only ones that can hold non-zero words.
+// Pages a device is mapped over point at it.
+struct Page {
+  uint8_t *data;
+  struct CodePage *code;
+  struct Device *device;
+};
+
+// Structure to define the state of the ARM machine and
+// represent the memory, registers, and instructions
+// to decode and execute on the next cycle along with the decoded type.
+// The predecoded entries of the two in-flight instructions are kept
+// alongside their raw words. Every machine is self-contained, so several
+// can run at once on different threads.
+// Memory holds pageCount pages. Those of the loaded binary point into a
+// private mapping of it, so they are only copied once they are written.
+// The page of the latest memory access and the code of the page last
+// fetched from are remembered, so most accesses skip the table walk.
+struct State {
+  struct Page *pageTable[DIRECTORY_SIZE];
+  uint32_t pageCount;
+  uint32_t recentNumber;
+  struct Page *recentPage;
+  uint32_t fetchNumber;
+  struct CodePage *fetchCode;
+  uint8_t *image;
+  size_t imageSize;
+  struct ElfSymbol *symbols;
+  uint32_t symbolCount;
+  struct Device devices[MAX_DEVICES];
+  uint32_t deviceCount;
+  struct Gpio *gpio;
+  struct Profile *profile;
+  struct Trace *trace;
+  uint32_t registers[17];
+  struct Flags flags;
+  uint32_t toDecode;
+  uint32_t toExecute;
+  enum decodeType decodedType;
+  const struct Instruction *decoding;
+  const struct Instruction *executing;
+  struct Instruction prefetched[2];
+  bool blocksStale;
+  bool fast;
+  struct Jit *jit;
+  struct Instruction outOfRange;
+  FILE *output;
+};
+
+void clearMemory(struct State *state);
+
+void predecode(struct Instruction *instruction, uint32_t word);
+
+void cycle(struct State *state);
+
+void materialiseFlags(struct State *state);
+
+bool cond(struct State *state, uint32_t condition);
+
+void setCPSR(struct State *state, uint32_t result, int cFlag);
+
+void setResultFlags(struct State *state, uint32_t result);
+
+uint32_t aluAdd(struct State *state, int32_t op1, int32_t op2, bool set);
+
+uint32_t aluSub(struct State *state, int32_t op1, int32_t op2, bool set);
+
+void transferData(struct State *state, bool mode, uint32_t source,
+                  uint32_t destination, int32_t offset);
@@ -0,0 +1,733 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "machine.h"
+
+// Differential fuzzer for the assembler and emulator. Random sequences of
+// valid instructions are assembled with the assembler's own main(), run on
+// every emulator engine, and the registers, flags and memory they leave
+// compared with those of a reference model of the instructions written
+// straight from the ARM specification. A failing sequence is shrunk to as
+// few instructions as still fail before it is reported.
+
+// Defined by assemble.c, which is built into the fuzzer with main renamed.
+int assembleMain(int argc, char **argv);
+
+#define MAX_ITEMS (256)
+#define MAX_SKIP (4)
+
+// r0 to r9 hold data, r10 indexes memory and r11 is the base address of
+// every load and store, which moves around the middle of the data area.
+#define DATA_REGISTERS (10)
+#define INDEX_REGISTER (10)
+#define BASE_REGISTER (11)
+#define DATA_START (0x4000)
+#define DATA_BASE (0x8000)
+#define DATA_END (0xc000)
+#define DATA_WORDS ((DATA_END - DATA_START) / 4)
+
+// Post-indexed offsets are small enough that the base stays in the data
+// area however many of them a sequence has.
+#define MAX_POST_OFFSET (48)
+#define MAX_PRE_OFFSET (1020)
+
+enum itemKind {
+  DataItem,
+  CompareItem,
+  MoveItem,
+  MultiplyItem,
+  LiteralItem,
+  TransferItem,
+  IndexedItem,
+  BranchItem,
+  ITEM_KINDS
+};
+
+enum shiftType {
+  Lsl,
+  Lsr,
+  Asr,
+  Ror
+};
+
+// One source line, or two for an indexed transfer, which sets the index
+// register just before using it.
+struct Item {
+  enum itemKind kind;
+  int opcode;
+  int rd, rn, rm;
+  bool immediate;
+  uint32_t value;
+  bool shifted;
+  enum shiftType shiftType;
+  int shiftAmount;
+  bool load;
+  bool post;
+  int32_t offset;
+  int cond;
+  int skip;
+};
+
+struct Program {
+  struct Item items[MAX_ITEMS];
+  int count;
+};
+
+// Memory this far either side of the words a sequence accesses is compared
+// as well, to catch stores that go astray.
+#define SLACK_WORDS (1024)
+
+// What a run leaves behind: r0 to r12, the flags and the words of the data
+// area from first up to last.
+struct Outcome {
+  uint32_t registers[13];
+  uint32_t flags;
+  int first;
+  int last;
+  uint32_t memory[DATA_WORDS];
+};
+
+static const char *opcodeNames[] = {"and", "eor", "sub", "rsb", "add", "",
+                                    "",    "",    "tst", "teq", "cmp", "",
+                                    "orr", "mov", "",    "mvn"};
+static const int dataOpcodes[] = {0, 1, 2, 3, 4, 12};
+static const char *shiftNames[] = {"lsl", "lsr", "asr", "ror"};
+static const int conditions[] = {0, 1, 10, 11, 12, 13, 14};
+static const char *conditionNames[] = {
+    [0] = "eq", [1] = "ne", [10] = "ge", [11] = "lt",
+    [12] = "gt", [13] = "le", [14] = ""};
+static const char *engineNames[] = {"pipeline", "fast", "jit"};
+
+// -----------------------------------------------------------------------------
+
+// Generating sequences. Every case has its own seed, so any one of them can
+// be run again on its own.
+
+static uint64_t randomState;
+
+static uint32_t randomWord(void) {
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 7;
+  randomState ^= randomState << 17;
+  return randomState >> 16;
+}
+
+static uint32_t below(uint32_t n) {
+  return randomWord() % n;
+}
+
+static uint32_t rotateRightWord(uint32_t value, int amount) {
+  amount &= 31;
+  return amount == 0 ? value : value >> amount | value << (32 - amount);
+}
+
+// Values near the edges of arithmetic are picked more often than others.
+static uint32_t interestingWord(void) {
+  static const uint32_t edges[] = {0,          1,          0x7fffffff,
+                                   0x80000000, 0xffffffff, 0xff,
+                                   0x100,      0xffffff,   0x1000000};
+  switch (below(4)) {
+    case 0:
+      return edges[below(sizeof(edges) / sizeof(edges[0]))];
+    case 1:
+      return below(0x200);
+    default:
+      return randomWord() << 16 ^ randomWord();
+  }
+}
+
+static void generateOperand2(struct Item *item) {
+  if (below(2)) {
+    item->immediate = true;
+    item->value = rotateRightWord(below(256), below(16) * 2);
+    return;
+  }
+  item->rm = below(DATA_REGISTERS);
+  item->shifted = below(2);
+  if (item->shifted) {
+    item->shiftType = below(4);
+    // Shifts of 0 other than lsl mean something else and are not written.
+    item->shiftAmount = item->shiftType == Lsl ? below(32) : 1 + below(31);
+  }
+}
+
+static void generateItem(struct Item *item) {
+  memset(item, 0, sizeof(struct Item));
+  item->kind = below(ITEM_KINDS);
+  item->rd = below(DATA_REGISTERS);
+  item->rn = below(DATA_REGISTERS);
+  switch (item->kind) {
+    case DataItem:
+      item->opcode = dataOpcodes[below(6)];
+      generateOperand2(item);
+      // Negated constants are encoded by swapping add and sub.
+      if (item->immediate && (item->opcode == 2 || item->opcode == 4) &&
+          below(4) == 0) {
+        item->value = -item->value;
+      }
+      // Operations in place, some adding nothing, give the peephole
+      // optimiser something to fold and remove.
+      if (below(4) == 0) {
+        item->rn = item->rd;
+        if (item->immediate && below(2)) {
+          item->value = 0;
+        }
+      }
+      break;
+    case CompareItem:
+      item->opcode = 8 + below(3);
+      generateOperand2(item);
+      break;
+    case MoveItem:
+      item->opcode = below(2) ? 13 : 15;
+      generateOperand2(item);
+      // Any constant can be moved, through mvn or the literal pool.
+      if (item->immediate && below(2)) {
+        item->value = interestingWord();
+      }
+      if (!item->immediate && below(4) == 0) {
+        item->rm = item->rd;
+        item->shifted = false;
+      }
+      break;
+    case MultiplyItem:
+      item->rm = below(DATA_REGISTERS);
+      // The destination must differ from the first operand.
+      if (item->rm == item->rd) {
+        item->rm = (item->rm + 1) % DATA_REGISTERS;
+      }
+      item->opcode = below(2);
+      item->value = below(DATA_REGISTERS);
+      break;
+    case LiteralItem:
+      item->value = interestingWord();
+      break;
+    case TransferItem:
+      item->load = below(2);
+      item->post = below(2);
+      if (item->post) {
+        item->offset = (int32_t) below(2 * MAX_POST_OFFSET / 4 + 1) * 4 -
+                       MAX_POST_OFFSET;
+      } else {
+        item->offset = (int32_t) below(2 * MAX_PRE_OFFSET / 4 + 1) * 4 -
+                       MAX_PRE_OFFSET;
+      }
+      break;
+    case IndexedItem:
+      item->load = below(2);
+      item->post = below(2);
+      if (item->post) {
+        item->value = below(MAX_POST_OFFSET / 4) * 4;
+      } else {
+        // The shifted index is a whole number of words. Rotating it would
+        // take it out of the data area.
+        item->shifted = below(2);
+        item->shiftType = item->shifted ? below(3) : Lsl;
+        item->shiftAmount = item->shiftType == Lsl ? below(4) : 1 + below(6);
+        item->value = below(16) * 4;
+        if (item->shiftType != Lsl) {
+          item->value <<= item->shiftAmount;
+        }
+      }
+      break;
+    default:
+      item->cond = conditions[below(7)];
+      item->skip = 1 + below(MAX_SKIP);
+      break;
+  }
+}
+
+static void generateProgram(struct Program *program, int maxLength) {
+  program->count = 1 + below(maxLength);
+  for (int i = 0; i < program->count; i++) {
+    generateItem(&program->items[i]);
+  }
+}
+
+// -----------------------------------------------------------------------------
+
+// Writing sequences as assembly.
+
+static void writeOperand2(FILE *output, const struct Item *item) {
+  if (item->immediate) {
+    fprintf(output, "#0x%x", item->value);
+  } else if (item->shifted) {
+    fprintf(output, "r%d,%s #%d", item->rm, shiftNames[item->shiftType],
+            item->shiftAmount);
+  } else {
+    fprintf(output, "r%d", item->rm);
+  }
+}
+
+static void writeItem(FILE *output, const struct Item *item, int index) {
+  const char *transfer = item->load ? "ldr" : "str";
+  switch (item->kind) {
+    case DataItem:
+      fprintf(output, "%s r%d,r%d,", opcodeNames[item->opcode], item->rd,
+              item->rn);
+      writeOperand2(output, item);
+      break;
+    case CompareItem:
+      fprintf(output, "%s r%d,", opcodeNames[item->opcode], item->rn);
+      writeOperand2(output, item);
+      break;
+    case MoveItem:
+      fprintf(output, "%s r%d,", opcodeNames[item->opcode], item->rd);
+      writeOperand2(output, item);
+      break;
+    case MultiplyItem:
+      if (item->opcode) {
+        fprintf(output, "mla r%d,r%d,r%d,r%d", item->rd, item->rm, item->rn,
+                item->value);
+      } else {
+        fprintf(output, "mul r%d,r%d,r%d", item->rd, item->rm, item->rn);
+      }
+      break;
+    case LiteralItem:
+      fprintf(output, "ldr r%d,=0x%x", item->rd, item->value);
+      break;
+    case TransferItem:
+      if (item->post) {
+        fprintf(output, "%s r%d,[r%d],#%d", transfer, item->rd,
+                BASE_REGISTER, item->offset);
+      } else if (item->offset == 0) {
+        fprintf(output, "%s r%d,[r%d]", transfer, item->rd, BASE_REGISTER);
+      } else {
+        fprintf(output, "%s r%d,[r%d,#%d]", transfer, item->rd,
+                BASE_REGISTER, item->offset);
+      }
+      break;
+    case IndexedItem:
+      fprintf(output, "mov r%d,#%d\n", INDEX_REGISTER, item->value);
+      if (item->post) {
+        fprintf(output, "%s r%d,[r%d],r%d", transfer, item->rd, BASE_REGISTER,
+                INDEX_REGISTER);
+      } else if (item->shifted) {
+        fprintf(output, "%s r%d,[r%d,r%d,%s #%d]", transfer, item->rd,
+                BASE_REGISTER, INDEX_REGISTER, shiftNames[item->shiftType],
+                item->shiftAmount);
+      } else {
+        fprintf(output, "%s r%d,[r%d,r%d]", transfer, item->rd,
+                BASE_REGISTER, INDEX_REGISTER);
+      }
+      break;
+    default:
+      fprintf(output, "b%s skip%d", conditionNames[item->cond], index);
+      break;
+  }
+}
+
+// Writes the program with a label after the items each branch skips. A
+// branch skipping past the end lands on the last line.
+static void writeProgram(FILE *output, const struct Program *program) {
+  fprintf(output, "mov r%d,#0x%x\n", BASE_REGISTER, DATA_BASE);
+  for (int i = 0; i < program->count; i++) {
+    writeItem(output, &program->items[i], i);
+    fprintf(output, "\n");
+    for (int j = 0; j < i; j++) {
+      const struct Item *from = &program->items[j];
+      if (from->kind == BranchItem && j + from->skip == i) {
+        fprintf(output, "skip%d:\n", j);
+      }
+    }
+  }
+  for (int j = 0; j < program->count; j++) {
+    const struct Item *from = &program->items[j];
+    if (from->kind == BranchItem && j + from->skip >= program->count) {
+      fprintf(output, "skip%d:\n", j);
+    }
+  }
+  fprintf(output, "andeq r0,r0,r0\n");
+}
+
+// -----------------------------------------------------------------------------
+
+// The reference model.
+
+struct Model {
+  uint32_t registers[13];
+  bool n, z, c, v;
+  uint32_t memory[DATA_WORDS];
+  int lowest;
+  int highest;
+};
+
+static uint32_t *modelWord(struct Model *model, uint32_t address) {
+  int index = (address - DATA_START) / 4;
+  if (index < model->lowest) {
+    model->lowest = index;
+  }
+  if (index > model->highest) {
+    model->highest = index;
+  }
+  return &model->memory[index];
+}
+
+// Returns the shifted register or immediate operand and the shifter's carry.
+static uint32_t operand2(const struct Model *model, const struct Item *item,
+                         bool *carry) {
+  *carry = model->c;
+  if (item->immediate) {
+    // Only a rotated immediate sets the carry, to its top bit.
+    for (int rotate = 0; rotate < 32; rotate += 2) {
+      if ((rotateRightWord(item->value, 32 - rotate) & ~0xffu) == 0) {
+        if (rotate != 0) {
+          *carry = item->value >> 31;
+        }
+        break;
+      }
+    }
+    return item->value;
+  }
+  uint32_t value = model->registers[item->rm];
+  int amount = item->shifted ? item->shiftAmount : 0;
+  if (amount == 0) {
+    return value;
+  }
+  switch (item->shiftType) {
+    case Lsl:
+      *carry = value >> (32 - amount) & 1;
+      return value << amount;
+    case Lsr:
+      *carry = value >> (amount - 1) & 1;
+      return value >> amount;
+    case Asr:
+      *carry = value >> (amount - 1) & 1;
+      return (uint32_t) ((int32_t) value >> amount);
+    default:
+      *carry = value >> (amount - 1) & 1;
+      return rotateRightWord(value, amount);
+  }
+}
+
+static void modelData(struct Model *model, const struct Item *item) {
+  bool carry;
+  uint32_t op2 = operand2(model, item, &carry);
+  uint32_t op1 = model->registers[item->rn];
+  uint32_t result;
+  switch (item->opcode) {
+    case 0:
+    case 8:
+      result = op1 & op2;
+      break;
+    case 1:
+    case 9:
+      result = op1 ^ op2;
+      break;
+    case 2:
+    case 10:
+      result = op1 - op2;
+      break;
+    case 3:
+      result = op2 - op1;
+      break;
+    case 4:
+      result = op1 + op2;
+      break;
+    case 12:
+      result = op1 | op2;
+      break;
+    case 13:
+      result = op2;
+      break;
+    default:
+      result = ~op2;
+      break;
+  }
+  if (item->opcode < 8 || item->opcode > 10) {
+    model->registers[item->rd] = result;
+    return;
+  }
+  // Only the comparisons set the flags.
+  model->n = result >> 31;
+  model->z = result == 0;
+  // As the emulator implements the instruction set, data processing leaves
+  // V alone.
+  if (item->opcode == 10) {
+    model->c = op1 >= op2;
+  } else {
+    model->c = carry;
+  }
+}
+
+static bool conditionHolds(const struct Model *model, int cond) {
+  switch (cond) {
+    case 0:
+      return model->z;
+    case 1:
+      return !model->z;
+    case 10:
+      return model->n == model->v;
+    case 11:
+      return model->n != model->v;
+    case 12:
+      return !model->z && model->n == model->v;
+    case 13:
+      return model->z || model->n != model->v;
+    default:
+      return true;
+  }
+}
+
+static void modelTransfer(struct Model *model, const struct Item *item,
+                          uint32_t address) {
+  if (item->load) {
+    model->registers[item->rd] = *modelWord(model, address);
+  } else {
+    *modelWord(model, address) = model->registers[item->rd];
+  }
+}
+
+static void runModel(const struct Program *program, struct Outcome *outcome) {
+  static struct Model model;
+  memset(&model, 0, sizeof(model));
+  model.registers[BASE_REGISTER] = DATA_BASE;
+  model.lowest = model.highest = (DATA_BASE - DATA_START) / 4;
+  uint32_t *base = &model.registers[BASE_REGISTER];
+  uint32_t *index = &model.registers[INDEX_REGISTER];
+
+  for (int i = 0; i < program->count; i++) {
+    const struct Item *item = &program->items[i];
+    switch (item->kind) {
+      case DataItem:
+      case CompareItem:
+      case MoveItem:
+        modelData(&model, item);
+        break;
+      case MultiplyItem:
+        model.registers[item->rd] =
+            model.registers[item->rm] * model.registers[item->rn] +
+            (item->opcode ? model.registers[item->value] : 0);
+        break;
+      case LiteralItem:
+        model.registers[item->rd] = item->value;
+        break;
+      case TransferItem:
+        if (item->post) {
+          modelTransfer(&model, item, *base);
+          *base += item->offset;
+        } else {
+          modelTransfer(&model, item, *base + item->offset);
+        }
+        break;
+      case IndexedItem:
+        *index = item->value;
+        if (item->post) {
+          modelTransfer(&model, item, *base);
+          *base += *index;
+        } else {
+          struct Item shifted = *item;
+          shifted.immediate = false;
+          shifted.rm = INDEX_REGISTER;
+          bool carry;
+          modelTransfer(&model, item, *base + operand2(&model, &shifted,
+                                                        &carry));
+        }
+        break;
+      default:
+        if (conditionHolds(&model, item->cond)) {
+          i += item->skip;
+        }
+        break;
+    }
+  }
+
+  memcpy(outcome->registers, model.registers, sizeof(outcome->registers));
+  outcome->flags = (uint32_t) model.n << 31 | (uint32_t) model.z << 30 |
+                   (uint32_t) model.c << 29 | (uint32_t) model.v << 28;
+  outcome->first = model.lowest > SLACK_WORDS ? model.lowest - SLACK_WORDS : 0;
+  outcome->last = model.highest + SLACK_WORDS < DATA_WORDS
+                      ? model.highest + SLACK_WORDS
+                      : DATA_WORDS - 1;
+  memcpy(outcome->memory, model.memory, sizeof(outcome->memory));
+}
+
+// -----------------------------------------------------------------------------
+
+// Running sequences through the assembler and emulator.
+
+static char sourceFile[4096];
+static char binaryFile[4096];
+// Whether the assembler runs its peephole optimiser.
+static bool optimiseAssembly = false;
+
+static void assembleProgram(const struct Program *program) {
+  FILE *source = fopen(sourceFile, "w");
+  if (source == NULL) {
+    perror(sourceFile);
+    exit(EXIT_FAILURE);
+  }
+  writeProgram(source, program);
+  fclose(source);
+
+  char *argv[5];
+  int argc = 0;
+  argv[argc++] = "assemble";
+  if (optimiseAssembly) {
+    argv[argc++] = "-O";
+  }
+  argv[argc++] = sourceFile;
+  argv[argc++] = binaryFile;
+  argv[argc] = NULL;
+  if (assembleMain(argc, argv) != EXIT_SUCCESS) {
+    fprintf(stderr, "The assembler failed on %s.\n", sourceFile);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Runs the assembled sequence, reading back the same words of memory as the
+// model's outcome has.
+static void runEngine(enum machineEngine engine,
+                      const struct Outcome *expected, struct Outcome *outcome) {
+  Machine *machine = machine_new(engine);
+  if (!machine_load(machine, binaryFile)) {
+    exit(EXIT_FAILURE);
+  }
+  machine_run(machine);
+  for (int i = 0; i < 13; i++) {
+    outcome->registers[i] = machine_register(machine, i);
+  }
+  outcome->flags = machine_register(machine, 16) & 0xf0000000;
+  outcome->first = expected->first;
+  outcome->last = expected->last;
+  for (int i = outcome->first; i <= outcome->last; i++) {
+    outcome->memory[i] = machine_read_word(machine, DATA_START + i * 4);
+  }
+  machine_free(machine);
+}
+
+// Returns the first engine whose outcome differs from the model's, or -1 if
+// they all agree, filling in both outcomes.
+static int findMismatch(const struct Program *program, struct Outcome *expected,
+                        struct Outcome *actual) {
+  runModel(program, expected);
+  assembleProgram(program);
+  for (int engine = PipelineEngine; engine <= JitEngine; engine++) {
+    runEngine(engine, expected, actual);
+    size_t words = expected->last - expected->first + 1;
+    if (memcmp(expected->registers, actual->registers,
+               sizeof(expected->registers)) != 0 ||
+        expected->flags != actual->flags ||
+        memcmp(&expected->memory[expected->first],
+               &actual->memory[expected->first],
+               words * sizeof(uint32_t)) != 0) {
+      return engine;
+    }
+  }
+  return -1;
+}
+
+// Removes ever smaller runs of items while the program still fails.
+static void shrink(struct Program *program) {
+  static struct Outcome expected, actual;
+  static struct Program candidate;
+  for (int length = program->count / 2; length >= 1; length /= 2) {
+    for (int start = 0; start + length <= program->count;) {
+      candidate.count = program->count - length;
+      memcpy(candidate.items, program->items, start * sizeof(struct Item));
+      memcpy(&candidate.items[start], &program->items[start + length],
+             (program->count - start - length) * sizeof(struct Item));
+      if (candidate.count > 0 &&
+          findMismatch(&candidate, &expected, &actual) >= 0) {
+        *program = candidate;
+      } else {
+        start++;
+      }
+    }
+  }
+}
+
+static void report(const struct Program *program, uint64_t seed) {
+  static struct Outcome expected, actual;
+  int engine = findMismatch(program, &expected, &actual);
+  printf("Case %llu fails on the %s engine, shrunk to:\n",
+         (unsigned long long) seed, engineNames[engine]);
+  writeProgram(stdout, program);
+  printf("Expected / actual:\n");
+  for (int i = 0; i < 13; i++) {
+    if (expected.registers[i] != actual.registers[i]) {
+      printf("r%-4d 0x%08x 0x%08x\n", i, expected.registers[i],
+             actual.registers[i]);
+    }
+  }
+  if (expected.flags != actual.flags) {
+    printf("flags 0x%08x 0x%08x\n", expected.flags, actual.flags);
+  }
+  for (int i = expected.first; i <= expected.last; i++) {
+    if (expected.memory[i] != actual.memory[i]) {
+      printf("[0x%04x] 0x%08x 0x%08x\n", DATA_START + i * 4,
+             expected.memory[i], actual.memory[i]);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  // --cases gives how many sequences are tried, --seed the seed of the
+  // first, whose successors have the seeds that follow, --length the most
+  // items a sequence has, and --optimise assembles them with -O.
+  uint64_t cases = 10000;
+  uint64_t firstSeed = 1;
+  int maxLength = 32;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--cases") == 0 && i + 1 < argc) {
+      cases = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      firstSeed = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--length") == 0 && i + 1 < argc) {
+      maxLength = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--optimise") == 0) {
+      optimiseAssembly = true;
+    } else {
+      maxLength = 0;
+      break;
+    }
+  }
+  if (maxLength <= 0 || maxLength > MAX_ITEMS) {
+    fprintf(stderr, "Usage: differential [--cases N] [--seed N] "
+                    "[--length N] [--optimise]\n");
+    exit(EXIT_FAILURE);
+  }
+
+  char directory[] = "/tmp/differentialXXXXXX";
+  if (mkdtemp(directory) == NULL) {
+    perror("Error creating a working directory.\n");
+    exit(EXIT_FAILURE);
+  }
+  snprintf(sourceFile, sizeof(sourceFile), "%s/case.s", directory);
+  snprintf(binaryFile, sizeof(binaryFile), "%s/case.bin", directory);
+
+  static struct Program program;
+  static struct Outcome expected, actual;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int status = EXIT_SUCCESS;
+  uint64_t done = 0;
+  for (; done < cases; done++) {
+    uint64_t seed = firstSeed + done;
+    // The state of xorshift must not be zero.
+    randomState = seed * 0x9e3779b97f4a7c15ull | 1;
+    generateProgram(&program, maxLength);
+    if (findMismatch(&program, &expected, &actual) >= 0) {
+      shrink(&program);
+      report(&program, seed);
+      status = EXIT_FAILURE;
+      done++;
+      break;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) +
+                   (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%llu cases in %.2f s, %.0f cases/s\n", (unsigned long long) done,
+         seconds, done / seconds);
+
+  remove(sourceFile);
+  remove(binaryFile);
+  rmdir(directory);
+  return status;
+}
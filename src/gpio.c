@@ -0,0 +1,92 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "emulate.h"
+#include "gpio.h"
+
+#define GPIO_PINS (54)
+
+// Register offsets: function selects for ten pins each, then one bit per
+// pin to set, clear and read the level of.
+#define GPFSEL0 (0x00)
+#define GPFSEL5 (0x14)
+#define GPSET0 (0x1c)
+#define GPSET1 (0x20)
+#define GPCLR0 (0x28)
+#define GPCLR1 (0x2c)
+#define GPLEV0 (0x34)
+#define GPLEV1 (0x38)
+
+struct Gpio {
+  uint32_t select[6];
+  uint32_t level[2];
+};
+
+struct Gpio *gpioNew(void) {
+  struct Gpio *gpio = calloc(1, sizeof(struct Gpio));
+  if (gpio == NULL) {
+    perror("Error allocating the GPIO controller.\n");
+    exit(EXIT_FAILURE);
+  }
+  return gpio;
+}
+
+// Logs a pin event against the instruction that caused it, which reads
+// r15 as its own address plus 8.
+static void logPin(struct State *state, uint32_t pin, const char *event) {
+  fprintf(state->output, "GPIO 0x%08x: pin %u %s\n",
+          state->registers[15] - 8, pin, event);
+}
+
+uint32_t gpioRead(struct State *state, void *context, uint32_t offset) {
+  struct Gpio *gpio = context;
+  offset &= ~3;
+  if (offset <= GPFSEL5) {
+    return gpio->select[offset / 4];
+  } else if (offset == GPLEV0 || offset == GPLEV1) {
+    return gpio->level[(offset - GPLEV0) / 4];
+  }
+  return 0;
+}
+
+// Sets the levels of a bank of 32 pins, logging the ones that change.
+static void setLevels(struct State *state, struct Gpio *gpio, uint32_t bank,
+                      uint32_t level) {
+  uint32_t changed = gpio->level[bank] ^ level;
+  gpio->level[bank] = level;
+  for (; changed != 0; changed &= changed - 1) {
+    uint32_t bit = __builtin_ctz(changed);
+    uint32_t pin = bank * 32 + bit;
+    if (pin < GPIO_PINS) {
+      logPin(state, pin, (level >> bit & 1) ? "high" : "low");
+    }
+  }
+}
+
+void gpioWrite(struct State *state, void *context, uint32_t offset,
+               uint32_t value) {
+  // Names of the eight functions a pin can be selected for.
+  static const char *functions[8] = {"input", "output", "alt5", "alt4",
+                                     "alt0",  "alt1",   "alt2", "alt3"};
+  struct Gpio *gpio = context;
+  offset &= ~3;
+
+  if (offset <= GPFSEL5) {
+    uint32_t changed = gpio->select[offset / 4] ^ value;
+    gpio->select[offset / 4] = value;
+    for (uint32_t i = 0; i < 10; i++) {
+      uint32_t pin = offset / 4 * 10 + i;
+      if (pin < GPIO_PINS && (changed >> 3 * i & 7) != 0) {
+        logPin(state, pin, functions[value >> 3 * i & 7]);
+      }
+    }
+  } else if (offset == GPSET0 || offset == GPSET1) {
+    uint32_t bank = (offset - GPSET0) / 4;
+    setLevels(state, gpio, bank, gpio->level[bank] | value);
+  } else if (offset == GPCLR0 || offset == GPCLR1) {
+    uint32_t bank = (offset - GPCLR0) / 4;
+    setLevels(state, gpio, bank, gpio->level[bank] & ~value);
+  }
+}
@@ -0,0 +1,16 @@
+#include <stdint.h>
+
+// Model of the Raspberry Pi (BCM2835) GPIO controller.
+
+#define GPIO_BASE (0x20200000)
+#define GPIO_SIZE (0xb4)
+
+struct Gpio;
+struct State;
+
+struct Gpio *gpioNew(void);
+
+uint32_t gpioRead(struct State *state, void *context, uint32_t offset);
+
+void gpioWrite(struct State *state, void *context, uint32_t offset,
+               uint32_t value);
@@ -0,0 +1,509 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "emulate.h"
+#include "jit.h"
+
+#define JIT_CAPACITY (1 << 22)
+// Upper bound on the host code emitted for a single operation.
+#define MAX_OP_CODE (128)
+
+// Host register numbers as used in ModRM encodings.
+#define EAX (0)
+#define ECX (1)
+#define EDX (2)
+#define ESI (6)
+
+// Opcode extensions of the 0xc1 shift group.
+#define SHL (4)
+#define SHR (5)
+#define SAR (7)
+
+// Executable buffer that a machine's compiled blocks are appended to.
+struct Jit {
+  uint8_t *buffer;
+  size_t used;
+};
+
+#if defined(__x86_64__)
+
+static void emit(struct Jit *jit, uint8_t byte) {
+  jit->buffer[jit->used++] = byte;
+}
+
+static void emit32(struct Jit *jit, uint32_t value) {
+  memcpy(&jit->buffer[jit->used], &value, 4);
+  jit->used += 4;
+}
+
+// Offset of an emulated register from the state pointer kept in rbx.
+static uint32_t reg(uint32_t n) {
+  return offsetof(struct State, registers) + 4 * n;
+}
+
+// mov host, [rbx + reg(n)]
+static void loadRegister(struct Jit *jit, int host, uint32_t n) {
+  emit(jit, 0x8b);
+  emit(jit, 0x83 | host << 3);
+  emit32(jit, reg(n));
+}
+
+// mov [rbx + reg(n)], host
+static void storeRegister(struct Jit *jit, uint32_t n, int host) {
+  emit(jit, 0x89);
+  emit(jit, 0x83 | host << 3);
+  emit32(jit, reg(n));
+}
+
+// mov dword [rbx + reg(n)], value
+static void storeImmediate(struct Jit *jit, uint32_t n, uint32_t value) {
+  emit(jit, 0xc7);
+  emit(jit, 0x83);
+  emit32(jit, reg(n));
+  emit32(jit, value);
+}
+
+static void moveImmediate(struct Jit *jit, int host, uint32_t value) {
+  emit(jit, 0xb8 + host);
+  emit32(jit, value);
+}
+
+// Two-operand ALU instruction such as add, sub, and, or, xor and mov.
+static void arithmetic(struct Jit *jit, uint8_t opcode, int destination,
+                       int source) {
+  emit(jit, opcode);
+  emit(jit, 0xc0 | source << 3 | destination);
+}
+
+static void moveRegister(struct Jit *jit, int destination, int source) {
+  arithmetic(jit, 0x89, destination, source);
+}
+
+static void shiftImmediate(struct Jit *jit, int extension, int host,
+                           uint32_t amount) {
+  emit(jit, 0xc1);
+  emit(jit, 0xc0 | extension << 3 | host);
+  emit(jit, amount);
+}
+
+// and host, 1
+static void lowestBit(struct Jit *jit, int host) {
+  emit(jit, 0x83);
+  emit(jit, 0xe0 | host);
+  emit(jit, 1);
+}
+
+// Calls a C function through rax, passing it the state pointer from rbx as
+// its first argument.
+static void call(struct Jit *jit, void (*function)(void)) {
+  uint64_t address;
+  memcpy(&address, &function, sizeof(address));
+  emit(jit, 0x48);  // mov rdi, rbx
+  emit(jit, 0x89);
+  emit(jit, 0xdf);
+  emit(jit, 0x48);
+  emit(jit, 0xb8);
+  emit32(jit, address);
+  emit32(jit, address >> 32);
+  emit(jit, 0xff);
+  emit(jit, 0xd0);
+}
+
+// Emits a jz with a placeholder target and returns where to patch it.
+static size_t jumpIfZero(struct Jit *jit) {
+  emit(jit, 0x84);
+  emit(jit, 0xc0);
+  emit(jit, 0x0f);
+  emit(jit, 0x84);
+  emit32(jit, 0);
+  return jit->used - 4;
+}
+
+static void patchJump(struct Jit *jit, size_t patch) {
+  uint32_t relative = jit->used - (patch + 4);
+  memcpy(&jit->buffer[patch], &relative, 4);
+}
+
+static void prologue(struct Jit *jit) {
+  emit(jit, 0x53);  // push rbx
+  emit(jit, 0x41);  // push r12
+  emit(jit, 0x54);
+  emit(jit, 0x48);  // sub rsp, 8
+  emit(jit, 0x83);
+  emit(jit, 0xec);
+  emit(jit, 0x08);
+  emit(jit, 0x48);  // mov rbx, rdi
+  emit(jit, 0x89);
+  emit(jit, 0xfb);
+}
+
+static void epilogue(struct Jit *jit) {
+  emit(jit, 0x48);  // add rsp, 8
+  emit(jit, 0x83);
+  emit(jit, 0xc4);
+  emit(jit, 0x08);
+  emit(jit, 0x41);  // pop r12
+  emit(jit, 0x5c);
+  emit(jit, 0x5b);  // pop rbx
+  emit(jit, 0xc3);  // ret
+}
+
+static bool isLogic(uint32_t opCode) {
+  return opCode == 0x0 || opCode == 0x1 || opCode == 0x8 || opCode == 0x9 ||
+         opCode == 0xc;
+}
+
+static bool isArithmetic(uint32_t opCode) {
+  return opCode == 0x2 || opCode == 0x3 || opCode == 0x4 || opCode == 0xa;
+}
+
+static bool writesResult(uint32_t opCode) {
+  return opCode <= 0x4 || opCode == 0xc || opCode == 0xd || opCode == 0xf;
+}
+
+// Whether an instruction updates the CPSR when it executes.
+static bool writesFlags(const struct Instruction *instruction) {
+  if (instruction->type == Multiply) {
+    return instruction->setFlags;
+  }
+  return instruction->type == DataProcessing && instruction->setFlags &&
+         (isLogic(instruction->opCode) || isArithmetic(instruction->opCode));
+}
+
+// Whether an instruction that updates the CPSR keeps the carry it had.
+static bool keepsCarry(const struct Instruction *instruction) {
+  return instruction->type == Multiply ||
+         (isLogic(instruction->opCode) && instruction->keepsCarry);
+}
+
+// Loads a register operand shifted by a constant into ecx, mirroring shift()
+// and, if asked for, leaving the carryOut() bit in edx.
+static void shiftedRegister(struct Jit *jit,
+                            const struct Instruction *instruction,
+                            bool carry) {
+  uint32_t amount = instruction->shiftAmount;
+  uint32_t type = instruction->shiftType;
+  loadRegister(jit, ECX, instruction->rm);
+
+  if (carry) {
+    uint32_t position = (type > 0 ? amount - 1 : 32 - amount) & 31;
+    moveRegister(jit, EDX, ECX);
+    if (position > 0) {
+      shiftImmediate(jit, SHR, EDX, position);
+    }
+    lowestBit(jit, EDX);
+  }
+
+  if (amount == 0) {
+    return;
+  }
+  if (type == 3) {
+    moveRegister(jit, ESI, ECX);
+    shiftImmediate(jit, SHR, ECX, amount);
+    shiftImmediate(jit, SHL, ESI, 32 - amount);
+    arithmetic(jit, 0x09, ECX, ESI);
+  } else {
+    int extensions[3] = {SHL, SHR, SAR};
+    shiftImmediate(jit, extensions[type], ECX, amount);
+  }
+}
+
+static void compileDataProcessing(struct Jit *jit,
+                                  const struct Instruction *instruction,
+                                  bool flagsLive) {
+  uint32_t opCode = instruction->opCode;
+  bool logic = isLogic(opCode);
+  bool setFlags = flagsLive && writesFlags(instruction);
+  bool writes = writesResult(opCode);
+
+  // Tests and comparisons whose flags are never read have no effect.
+  if (!writes && !setFlags) {
+    return;
+  }
+
+  // Operand2 goes to ecx and the shifter carry to edx.
+  if (instruction->form == Immediate) {
+    moveImmediate(jit, ECX, instruction->operand2);
+    if (setFlags && logic && !instruction->keepsCarry) {
+      moveImmediate(jit, EDX, instruction->carry);
+    }
+  } else {
+    shiftedRegister(jit, instruction,
+                    setFlags && logic && !instruction->keepsCarry);
+  }
+  loadRegister(jit, EAX, instruction->rn);
+
+  switch (opCode) {
+    case 0x0:  // and
+    case 0x8:  // tst
+      arithmetic(jit, 0x21, EAX, ECX);
+      break;
+    case 0x1:  // eor
+    case 0x9:  // teq
+      arithmetic(jit, 0x31, EAX, ECX);
+      break;
+    case 0xc:  // orr
+      arithmetic(jit, 0x09, EAX, ECX);
+      break;
+    case 0xd:  // mov
+      moveRegister(jit, EAX, ECX);
+      break;
+    case 0xf:  // mvn
+      moveRegister(jit, EAX, ECX);
+      // not eax
+      emit(jit, 0xf7);
+      emit(jit, 0xd0);
+      break;
+    case 0x2:  // sub
+    case 0xa:  // cmp
+    case 0x3:  // rsb
+    case 0x4:  // add
+      if (setFlags) {
+        // The flag rules live in aluAdd() and aluSub().
+        moveRegister(jit, ESI, opCode == 0x3 ? ECX : EAX);
+        moveRegister(jit, EDX, opCode == 0x3 ? EAX : ECX);
+        moveImmediate(jit, ECX, 1);
+        call(jit, opCode == 0x4 ? (void (*)(void))aluAdd
+                                : (void (*)(void))aluSub);
+      } else if (opCode == 0x4) {
+        arithmetic(jit, 0x01, EAX, ECX);
+      } else if (opCode == 0x3) {
+        arithmetic(jit, 0x29, ECX, EAX);
+        moveRegister(jit, EAX, ECX);
+      } else {
+        arithmetic(jit, 0x29, EAX, ECX);
+      }
+      break;
+  }
+
+  if (writes) {
+    storeRegister(jit, instruction->rd, EAX);
+  }
+  if (setFlags && logic && instruction->keepsCarry) {
+    moveRegister(jit, ESI, EAX);
+    call(jit, (void (*)(void))setResultFlags);
+  } else if (setFlags && logic) {
+    // The shifter carry is already in edx.
+    moveRegister(jit, ESI, EAX);
+    call(jit, (void (*)(void))setCPSR);
+  }
+}
+
+static void compileMultiply(struct Jit *jit,
+                            const struct Instruction *instruction,
+                            bool flagsLive) {
+  // imul eax, [rbx + reg(rs)]
+  loadRegister(jit, EAX, instruction->rm);
+  emit(jit, 0x0f);
+  emit(jit, 0xaf);
+  emit(jit, 0x83);
+  emit32(jit, reg(instruction->rs));
+
+  if (instruction->accumulate) {
+    // add eax, [rbx + reg(rn)], before the product is stored over it
+    emit(jit, 0x03);
+    emit(jit, 0x83);
+    emit32(jit, reg(instruction->rn));
+  }
+  storeRegister(jit, instruction->rd, EAX);
+
+  if (flagsLive && instruction->setFlags) {
+    moveRegister(jit, ESI, EAX);
+    call(jit, (void (*)(void))setResultFlags);
+  }
+}
+
+static void compileSingleDataTransfer(struct Jit *jit,
+                                      const struct Instruction *instruction) {
+  // The signed offset goes to ecx.
+  if (instruction->form == Immediate) {
+    moveImmediate(jit, ECX, instruction->up ? instruction->operand2
+                                       : -instruction->operand2);
+  } else {
+    shiftedRegister(jit, instruction, false);
+    if (!instruction->up) {
+      emit(jit, 0xf7);  // neg ecx
+      emit(jit, 0xd9);
+    }
+  }
+
+  if (!instruction->preIndexed) {
+    // mov r12d, ecx, then transfer with no offset.
+    emit(jit, 0x41);
+    emit(jit, 0x89);
+    emit(jit, 0xcc);
+    emit(jit, 0x41);  // mov r8d, 0
+    emit(jit, 0xb8);
+    emit32(jit, 0);
+  } else {
+    emit(jit, 0x41);  // mov r8d, ecx
+    emit(jit, 0x89);
+    emit(jit, 0xc8);
+  }
+  moveImmediate(jit, ESI, instruction->load);
+  moveImmediate(jit, EDX, instruction->rn);
+  moveImmediate(jit, ECX, instruction->rd);
+  call(jit, (void (*)(void))transferData);
+
+  if (!instruction->preIndexed) {
+    // add [rbx + reg(rn)], r12d
+    emit(jit, 0x44);
+    emit(jit, 0x01);
+    emit(jit, 0xa3);
+    emit32(jit, reg(instruction->rn));
+  }
+}
+
+// Compiles a final branch, returning 1 in eax if it is taken.
+static void compileBranch(struct Jit *jit, const struct Op *op) {
+  size_t skip = 0;
+  bool conditional = op->instruction.cond != 0xe;
+  if (conditional) {
+    moveImmediate(jit, ESI, op->instruction.cond);
+    call(jit, (void (*)(void))cond);
+    skip = jumpIfZero(jit);
+  }
+  storeImmediate(jit, 15, op->pc + op->instruction.offset);
+  moveImmediate(jit, EAX, 1);
+  epilogue(jit);
+  if (conditional) {
+    patchJump(jit, skip);
+  }
+}
+
+// Condition codes outside eq, ne, ge, lt, gt, le and al always fail.
+static bool neverPasses(uint32_t condition) {
+  return (condition > 0x1 && condition < 0xa) || condition == 0xf;
+}
+
+static bool translatable(const struct Instruction *instruction) {
+  return instruction->type != Branch &&
+         instruction->form != ShiftedByRegister;
+}
+
+void jitCompile(struct Jit *jit, struct Block *block) {
+  // Compiled code covers the same operations runBlock() would run in a loop,
+  // plus a final branch.
+  uint32_t count = block->halts ? block->length : block->length - 1;
+  bool endsInBranch =
+      !block->halts && block->ops[count].instruction.type == Branch;
+
+  if (jit->used + (count + 2) * MAX_OP_CODE > JIT_CAPACITY) {
+    return;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    if (!translatable(&block->ops[i].instruction)) {
+      return;
+    }
+  }
+
+  // Flags are computed lazily: a flag-setting operation only updates the
+  // CPSR if a later condition, an operation keeping its carry or the rest
+  // of the program can observe it before it is overwritten.
+  bool live[MAX_BLOCK_LENGTH];
+  bool liveAfter = true;
+  for (uint32_t i = count; i-- > 0;) {
+    const struct Instruction *instruction = &block->ops[i].instruction;
+    live[i] = liveAfter;
+    if (instruction->cond != 0xe) {
+      liveAfter = true;
+    } else if (writesFlags(instruction) && !keepsCarry(instruction)) {
+      liveAfter = false;
+    }
+  }
+
+  size_t start = jit->used;
+  prologue(jit);
+  for (uint32_t i = 0; i < count; i++) {
+    const struct Op *op = &block->ops[i];
+    const struct Instruction *instruction = &op->instruction;
+    if (neverPasses(instruction->cond)) {
+      continue;
+    }
+
+    size_t skip = 0;
+    bool conditional = instruction->cond != 0xe;
+    if (conditional) {
+      moveImmediate(jit, ESI, instruction->cond);
+      call(jit, (void (*)(void))cond);
+      skip = jumpIfZero(jit);
+    }
+    if (instruction->rn == 15 || instruction->rd == 15 ||
+        instruction->rs == 15 || instruction->rm == 15) {
+      storeImmediate(jit, 15, op->pc);
+    }
+
+    switch (instruction->type) {
+      case DataProcessing:
+        compileDataProcessing(jit, instruction, live[i]);
+        break;
+      case Multiply:
+        compileMultiply(jit, instruction, live[i]);
+        break;
+      case SingleDataTransfer:
+        compileSingleDataTransfer(jit, instruction);
+        break;
+      default:
+        break;
+    }
+
+    if (conditional) {
+      patchJump(jit, skip);
+    }
+  }
+
+  if (endsInBranch) {
+    compileBranch(jit, &block->ops[count]);
+  }
+  arithmetic(jit, 0x31, EAX, EAX);
+  epilogue(jit);
+
+  void *code = &jit->buffer[start];
+  memcpy(&block->code, &code, sizeof(block->code));
+}
+
+struct Jit *jitInit(void) {
+  struct Jit *jit = malloc(sizeof(struct Jit));
+  if (jit == NULL) {
+    return NULL;
+  }
+  void *region = mmap(NULL, JIT_CAPACITY, PROT_READ | PROT_WRITE | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED) {
+    free(jit);
+    return NULL;
+  }
+  jit->buffer = region;
+  jit->used = 0;
+  return jit;
+}
+
+void jitFree(struct Jit *jit) {
+  if (jit != NULL) {
+    munmap(jit->buffer, JIT_CAPACITY);
+    free(jit);
+  }
+}
+
+#else
+
+// Other hosts run every block through the threaded-code interpreter.
+void jitCompile(struct Jit *jit, struct Block *block) {
+}
+
+struct Jit *jitInit(void) {
+  return NULL;
+}
+
+void jitFree(struct Jit *jit) {
+}
+
+#endif
+
+void jitReset(struct Jit *jit) {
+  jit->used = 0;
+}
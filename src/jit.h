@@ -0,0 +1,16 @@
+#include <stdbool.h>
+
+// Dynamic translation of basic blocks into x86-64 host code. Each machine
+// owns its own executable buffer.
+
+struct Block;
+struct Jit;
+
+// Returns NULL if the host cannot run generated code.
+struct Jit *jitInit(void);
+
+void jitCompile(struct Jit *jit, struct Block *block);
+
+void jitReset(struct Jit *jit);
+
+void jitFree(struct Jit *jit);
@@ -0,0 +1,111 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer.h"
+#include "opcodes.h"
+
+static void lexError(const char *message, const char *line) {
+  fprintf(stderr, "Error: %s in \"%s\".\n", message, line);
+  exit(EXIT_FAILURE);
+}
+
+static bool isWordCharacter(char c) {
+  return isalnum((unsigned char) c) || c == '_' || c == '.';
+}
+
+// Parses the number at the cursor, written as strtol reads it.
+static const char *lexNumber(const char *cursor, struct Token *token,
+                             const char *line) {
+  char *end;
+  token->value = strtol(cursor, &end, 0);
+  if (end == cursor) {
+    lexError("expected a number", line);
+  }
+  token->negative = memchr(cursor, '-', end - cursor) != NULL;
+  return end;
+}
+
+// Reads a register name, r followed by its number, if one is at the cursor.
+static bool lexRegister(const char *cursor, size_t length,
+                        struct Token *token) {
+  if (cursor[0] != 'r' || length < 2 || length > 3) {
+    return false;
+  }
+  long number = 0;
+  for (size_t i = 1; i < length; i++) {
+    if (!isdigit((unsigned char) cursor[i])) {
+      return false;
+    }
+    number = number * 10 + cursor[i] - '0';
+  }
+  token->type = RegisterToken;
+  token->value = number;
+  return number <= 15;
+}
+
+int lex(const char *line, struct Token tokens[MAX_TOKENS + 1]) {
+  memset(tokens, 0, (MAX_TOKENS + 1) * sizeof(struct Token));
+  const char *cursor = line;
+  int count = 0;
+  while (true) {
+    while (*cursor == ' ' || *cursor == ',' || *cursor == '\t') {
+      cursor++;
+    }
+    if (*cursor == '\0') {
+      return count;
+    }
+    if (count == MAX_TOKENS) {
+      lexError("too many operands", line);
+    }
+
+    struct Token *token = &tokens[count++];
+    token->text = cursor;
+    switch (*cursor) {
+      case '[':
+        token->type = OpenToken;
+        cursor++;
+        break;
+      case ']':
+        token->type = CloseToken;
+        cursor++;
+        break;
+      case '#':
+        token->type = ImmediateToken;
+        cursor = lexNumber(cursor + 1, token, line);
+        break;
+      case '=':
+        token->type = LiteralToken;
+        cursor = lexNumber(cursor + 1, token, line);
+        break;
+      default: {
+        bool negative = *cursor == '-';
+        const char *start = cursor + negative;
+        const char *end = start;
+        while (isWordCharacter(*end)) {
+          end++;
+        }
+        if (end == start) {
+          lexError("unexpected character", line);
+        }
+        // The first word is the mnemonic, even for lsl.
+        int shift = recogniseShift(start, end - start);
+        if (lexRegister(start, end - start, token)) {
+          token->negative = negative;
+        } else if (token->type == RegisterToken) {
+          lexError("no such register", line);
+        } else if (negative) {
+          lexError("expected a register after -", line);
+        } else if (shift >= 0 && token != tokens) {
+          token->type = ShiftToken;
+          token->value = shift;
+        } else {
+          token->type = IdentifierToken;
+        }
+        cursor = end;
+      }
+    }
+    token->length = cursor - token->text;
+  }
+}
@@ -0,0 +1,35 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+// Lexer for one line of assembly. Tokens are typed and point into the line
+// they came from, so nothing is copied and operands have no length limit.
+
+// Most tokens an instruction can have, such as ldr r0,[r1,r2,lsl #2].
+#define MAX_TOKENS (16)
+
+// Enum for the type of a token. Numbers of registers, immediates, literals
+// and shift codes are parsed as the line is lexed.
+enum tokenType {
+  EndToken,
+  IdentifierToken,
+  RegisterToken,
+  ImmediateToken,
+  LiteralToken,
+  ShiftToken,
+  OpenToken,
+  CloseToken
+};
+
+struct Token {
+  enum tokenType type;
+  const char *text;
+  size_t length;
+  long value;
+  // Whether a register or number was written with a minus sign.
+  bool negative;
+};
+
+// Splits a line into tokens, filling the rest of the array with EndTokens,
+// and returns how many there are. Exits on characters that start no token
+// and on lines with more than MAX_TOKENS.
+int lex(const char *line, struct Token tokens[MAX_TOKENS + 1]);
@@ -0,0 +1,1073 @@
+#include <byteswap.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "elfLoader.h"
+#include "emulate.h"
+#include "jit.h"
+#include "gpio.h"
+#include "machine.h"
+#include "paging.h"
+#include "profile.h"
+#include "trace.h"
+#include "utils.h"
+
+// Releases all of memory and the code translated from it, keeping the
+// devices mapped over it.
+void clearMemory(struct State *state) {
+  freeMemory(state);
+  for (uint32_t i = 0; i < state->deviceCount; i++) {
+    mapDevice(state, &state->devices[i]);
+  }
+  if (state->jit != NULL) {
+    jitReset(state->jit);
+  }
+  state->blocksStale = false;
+}
+
+// Puts the registers, flags and pipeline back as a new machine has them,
+// so nothing of the last program carries over into the next.
+static void resetProcessor(struct State *state) {
+  memset(state->registers, 0, sizeof(state->registers));
+  memset(&state->flags, 0, sizeof(state->flags));
+  state->toDecode = EMPTY_LATCH;
+  state->toExecute = EMPTY_LATCH;
+  state->decodedType = DataProcessing;
+  state->decoding = NULL;
+  state->executing = NULL;
+  memset(state->prefetched, 0, sizeof(state->prefetched));
+}
+
+bool machine_load(Machine *state, const char *fileName) {
+  FILE *fp;
+  // Check if user has given a valid file path to program,
+  // if they have, open it as a readable binary file.
+  fp = fopen(fileName, "rb");
+  if (fp == NULL) {
+    perror(fileName);
+    return false;
+  }
+  clearMemory(state);
+  freeSymbols(state);
+  resetProcessor(state);
+
+  // Map the file as the initial contents of memory. The tail of its last
+  // page reads as zero, as the rest of memory does. Files that cannot be
+  // mapped, such as pipes, are read into memory instead. ELF executables
+  // have their segments read to where they belong.
+  struct stat info;
+  bool failed = false;
+  uint64_t memorySize = (uint64_t)state->pageCount << MEMORY_PAGE_BITS;
+  bool regular = fstat(fileno(fp), &info) == 0 && S_ISREG(info.st_mode);
+  if (regular && isElf(fp)) {
+    failed = !loadElf(state, fp, fileName);
+  } else if (regular) {
+    size_t size = (uint64_t)info.st_size < memorySize ? info.st_size
+                                                       : memorySize;
+    if (size > 0 && !mapImage(state, fileno(fp), size)) {
+      perror("Error mapping the binary file.\n");
+      failed = true;
+    }
+  } else {
+    readImage(state, fp);
+    failed = ferror(fp);
+    if (failed) {
+      perror("Error reading from stream.\n");
+    }
+  }
+  fclose(fp);
+  return !failed;
+}
+
+void machine_dump(Machine *state, FILE *output) {
+  // Output register states in decimal and hex aligned properly.
+  fprintf(output, "Registers:\n");
+  for (int i = 0; i < 13; i++) {
+    fprintf(output, "$%-3d: %10d (0x%08x)\n", i, state->registers[i],
+            state->registers[i]);
+  }
+  fprintf(output, "PC  : %10d (0x%08x)\n", state->registers[15],
+          state->registers[15]);
+  materialiseFlags(state);
+  fprintf(output, "CPSR: %10d (0x%08x)\n", state->registers[16],
+          state->registers[16]);
+
+  // Output Non-zero memory in hex in little endian format. Only pages that
+  // were loaded or written can hold any.
+  fprintf(output, "Non-zero memory:\n");
+  for (uint32_t i = 0; i < DIRECTORY_SIZE; i++) {
+    if (state->pageTable[i] == NULL) {
+      continue;
+    }
+    for (uint32_t j = 0; j < PAGE_TABLE_SIZE; j++) {
+      const uint8_t *data = state->pageTable[i][j].data;
+      uint32_t page = i << PAGE_TABLE_SHIFT | j << MEMORY_PAGE_BITS;
+      for (uint32_t k = 0; data != NULL && k < MEMORY_PAGE_SIZE; k += 4) {
+        uint32_t word;
+        memcpy(&word, &data[k], 4);
+        if (word != 0) {
+          fprintf(output, "0x%08x: 0x%08x\n", page + k, bswap_32(word));
+        }
+      }
+    }
+  }
+}
+
+// Classifies an instruction from bits 27..20 and 7..4, as packed into a
+// decode table index by decodeIndex().
+enum decodeType classify(uint32_t index) {
+  if (bit(index, 11)) {
+    return Branch;
+  } else if (bit(index, 10)) {
+    return SingleDataTransfer;
+  } else if (subByte(index, 11, 6) == 0 && subByte(index, 3, 4) == 9) {
+    return Multiply;
+  } else {
+    return DataProcessing;
+  }
+}
+
+// Decides whether a condition code passes for the given N, Z, C, V flags.
+bool evaluateCondition(uint32_t condition, uint32_t nzcv) {
+  bool v = bit(nzcv, 0);
+  bool z = bit(nzcv, 2);
+  bool n = bit(nzcv, 3);
+
+  switch (condition) {
+    case 0x0:  // eq
+      return z;
+    case 0x1:  // ne
+      return !z;
+    case 0xa:  // ge
+      return n == v;
+    case 0xb:  // lt
+      return n != v;
+    case 0xc:  // gt
+      return !z && (n == v);
+    case 0xd:  // le
+      return z || (n != v);
+    case 0xe:  // al
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Lookup tables for decoding, indexed by bits 27..20 and 7..4 of an
+// instruction, and for conditions, indexed by cond and the NZCV flags.
+enum decodeType decodeTable[1 << 12];
+bool conditionTable[16][16];
+
+void buildTables(void) {
+  for (uint32_t index = 0; index < (1 << 12); index++) {
+    decodeTable[index] = classify(index);
+  }
+  for (uint32_t condition = 0; condition < 16; condition++) {
+    for (uint32_t nzcv = 0; nzcv < 16; nzcv++) {
+      conditionTable[condition][nzcv] = evaluateCondition(condition, nzcv);
+    }
+  }
+}
+
+uint32_t decodeIndex(uint32_t instruction) {
+  return subByte(instruction, 27, 8) << 4 | subByte(instruction, 7, 4);
+}
+
+enum decodeType decode(uint32_t instruction) {
+  if (instruction == 0) {
+    return Terminate;
+  }
+  return decodeTable[decodeIndex(instruction)];
+}
+
+// Returns the carry flag the last flag-setting operation produced.
+bool carryFlag(struct State *state) {
+  struct Flags *flags = &state->flags;
+  switch (flags->source) {
+    case Logic:
+      return flags->carry;
+    case Addition:
+      // Set when the addition wrapped around.
+      return (uint32_t)flags->result < (uint32_t)flags->op1;
+    case Subtraction:
+      // Set unless the subtraction borrowed.
+      return (uint32_t)flags->op1 >= (uint32_t)flags->op2;
+    default:
+      return bit(state->registers[16], 29);
+  }
+}
+
+// Writes the N, Z and C bits of a pending flag update into the CPSR.
+void materialiseFlags(struct State *state) {
+  if (state->flags.source == Materialised) {
+    return;
+  }
+  uint32_t nFlag = (uint32_t)state->flags.result >> 31;
+  uint32_t zFlag = state->flags.result == 0;
+  uint32_t cFlag = carryFlag(state);
+  state->registers[16] = (state->registers[16] & 0x1fffffff) | nFlag << 31 |
+                        zFlag << 30 | cFlag << 29;
+  state->flags.source = Materialised;
+}
+
+// Utility function to decide whether CPSR register passes condition
+// Only conditions other than al need the pending flags written out.
+bool cond(struct State *state, uint32_t condition) {
+  if (condition == 0xe) {
+    return true;
+  }
+  materialiseFlags(state);
+  return conditionTable[condition][state->registers[16] >> 28];
+}
+
+// Records the result and carry of a logical operation or multiply, to be
+// written into the CPSR once the flags are read.
+void setCPSR(struct State *state, uint32_t result, int cFlag) {
+  state->flags.source = Logic;
+  state->flags.result = result;
+  state->flags.carry = cFlag;
+}
+
+// Returns the result of logical operations, updating CPSR if required
+uint32_t aluLogic(struct State *state, uint32_t result, bool set, bool carry) {
+  if (set) {
+    setCPSR(state, result, carry);
+  }
+  return result;
+}
+
+// Returns the result of an addition, updating CPSR if required.
+// The carry is only worked out when the flags are read.
+uint32_t aluAdd(struct State *state, int32_t op1, int32_t op2, bool set) {
+  int32_t result = (uint32_t)op1 + (uint32_t)op2;
+  if (set) {
+    state->flags.source = Addition;
+    state->flags.result = result;
+    state->flags.op1 = op1;
+    state->flags.op2 = op2;
+  }
+  return result;
+}
+
+// Returns the result of a subtraction, updating CPSR if required
+uint32_t aluSub(struct State *state, int32_t op1, int32_t op2, bool set) {
+  int32_t result = (uint32_t)op1 - (uint32_t)op2;
+  if (set) {
+    state->flags.source = Subtraction;
+    state->flags.result = result;
+    state->flags.op1 = op1;
+    state->flags.op2 = op2;
+  }
+  return result;
+}
+
+// Sets the flags for a multiply, or a logical operation whose shifter left
+// the carry alone, which keep the previous carry.
+void setResultFlags(struct State *state, uint32_t result) {
+  setCPSR(state, result, carryFlag(state));
+}
+
+// Performs arithmetic/logic operations based on opcode
+void alu(struct State *state, uint32_t opCode, uint32_t op1, uint32_t op2,
+         uint32_t destReg, bool set, bool carry) {
+  switch (opCode) {
+    case 0x0: {  // and
+      state->registers[destReg] = aluLogic(state, op1 & op2, set, carry);
+      break;
+    }
+    case 0x1: {  // eor
+      state->registers[destReg] = aluLogic(state, op1 ^ op2, set, carry);
+      break;
+    }
+    case 0x2: {  // sub
+      state->registers[destReg] = aluSub(state, op1, op2, set);
+      break;
+    }
+    case 0x3: {  // rsb
+      state->registers[destReg] = aluSub(state, op2, op1, set);
+      break;
+    }
+    case 0x4: {  // add
+      state->registers[destReg] = aluAdd(state, op1, op2, set);
+      break;
+    }
+    case 0x8: {  // tst
+      aluLogic(state, op1 & op2, set, carry);
+      break;
+    }
+    case 0x9: {  // teq
+      aluLogic(state, op1 ^ op2, set, carry);
+      break;
+    }
+    case 0xa: {  // cmp
+      aluSub(state, op1, op2, set);
+      break;
+    }
+    case 0xc: {  // orr
+      state->registers[destReg] = aluLogic(state, op1 | op2, set, carry);
+      break;
+    }
+    case 0xd: {  // mov
+      state->registers[destReg] = op2;
+      break;
+    }
+    case 0xf: {  // mvn
+      state->registers[destReg] = ~op2;
+    }
+  }
+}
+
+void dataProcessing(struct State *state,
+                    const struct Instruction *instruction) {
+  // Gets Operand1 from the predecoded Rn
+  uint32_t op1 = state->registers[instruction->rn];
+
+  uint32_t op2;
+  bool c = false;
+  bool keepsCarry = instruction->keepsCarry;
+
+  if (instruction->form == Immediate) {
+    // Operand2 and its carry were resolved when predecoding
+    op2 = instruction->operand2;
+    c = instruction->carry;
+  } else {  // Operand2 is a register
+    // Gets contents of Register M
+    uint32_t contents = state->registers[instruction->rm];
+    uint32_t shiftAmount = instruction->shiftAmount;
+
+    if (instruction->form == ShiftedByRegister) {
+      // Shift Register M by first byte stored in Register S
+      uint32_t regsVal = state->registers[instruction->rs];
+      shiftAmount = subByte(regsVal, 7, 8);
+      keepsCarry = shiftAmount == 0;
+    }
+
+    // Gets the shifted Operand2 and 'barrel shifter' Carry bit
+    op2 = shift(contents, shiftAmount, instruction->shiftType);
+    if (!keepsCarry) {
+      c = carryOut(contents, shiftAmount, instruction->shiftType);
+    }
+  }
+  if (keepsCarry && instruction->setFlags) {
+    c = carryFlag(state);
+  }
+
+  // Performs specified operation on operands
+  alu(state, instruction->opCode, op1, op2, instruction->rd,
+      instruction->setFlags, c);
+}
+
+void multiply(struct State *state, const struct Instruction *instruction) {
+  // If accumulate is set then multiply and accumulate
+  // else just multiply.
+  // The accumulator is read before the product is written, as it may be
+  // the destination.
+  uint32_t result =
+      state->registers[instruction->rm] * state->registers[instruction->rs];
+  if (instruction->accumulate) {
+    result += state->registers[instruction->rn];
+  }
+  state->registers[instruction->rd] = result;
+  if (instruction->setFlags) {
+    setResultFlags(state, result);
+  }
+}
+
+// Drops the predecoded entry for a word so that its next fetch decodes it
+// again. The fields are left intact for a copy that is already in flight.
+// Translated blocks covering the word are flushed before the next block runs.
+void invalidate(struct State *state, uint32_t address) {
+  struct Page *page = PAGE_OF(state, address);
+  if (page != NULL && page->code != NULL) {
+    uint32_t index = address % MEMORY_PAGE_SIZE / 4;
+    page->code->cache[index].valid = false;
+    if (page->code->translated[index]) {
+      state->blocksStale = true;
+    }
+  }
+}
+
+// Utility function to store 4 bytes of data to memory at given address.
+// Any predecoded word the store overlaps is invalidated.
+void store(struct State *state, uint32_t address, uint32_t data) {
+  writeWord(state, address, data);
+  if (state->trace != NULL) {
+    traceStore(state->trace, address, data);
+  }
+  invalidate(state, address);
+  invalidate(state, address + 3);
+}
+
+bool checkMemoryInBounds(struct State *state, uint32_t address) {
+  if (inBounds(state, address)) {
+    return true;
+  } else {
+    fprintf(state->output,
+            "Error: Out of bounds memory access at address 0x%08x\n", address);
+    return false;
+  }
+}
+
+// Passes a load or store on to the device mapped at its address.
+void accessDevice(struct State *state, struct Device *device, bool mode,
+                  uint32_t address, uint32_t destination) {
+  uint32_t offset = address - device->base;
+  if (mode) {
+    state->registers[destination] =
+        device->read != NULL ? device->read(state, device->context, offset)
+                             : 0;
+  } else if (device->write != NULL) {
+    device->write(state, device->context, offset,
+                  state->registers[destination]);
+  }
+}
+
+void transferData(struct State *state, bool mode, uint32_t source,
+                  uint32_t destination, int32_t offset) {
+  // Devices take precedence over memory. Plain memory accesses only pay for
+  // the device check on pages they look up anyway.
+  uint32_t address = state->registers[source] + offset;
+  struct Page *page = PAGE_OF(state, address);
+  if (page != NULL && page->device != NULL) {
+    accessDevice(state, page->device, mode, address, destination);
+    return;
+  }
+
+  // given a mode it either:
+  // true: loads the word from memory
+  // false: stores into memory
+  if (mode) {
+    // the word is loaded from memory
+    // check for valid memory range
+    if (checkMemoryInBounds(state, address)) {
+      state->registers[destination] = readWord(state, address);
+    }
+  } else {
+    // the word is stored into memory
+    if (checkMemoryInBounds(state, address)) {
+      store(state, address, state->registers[destination]);
+    }
+  }
+}
+
+int getShiftAmount(struct State *state, const struct Instruction *instruction) {
+  uint32_t shiftAmount = instruction->shiftAmount;
+
+  if (instruction->form == ShiftedByRegister) {
+    //  Shift Register M by a value stored in a register
+    uint32_t regsValue = state->registers[instruction->rs];
+    shiftAmount = subByte(regsValue, 7, 8);
+  }
+
+  uint32_t regmVal = state->registers[instruction->rm];
+  return shift(regmVal, shiftAmount, instruction->shiftType);
+}
+
+void singleDataTransfer(struct State *state,
+                        const struct Instruction *instruction) {
+  // Pre: the condition has been met and the current instruction
+  //      has been identified by the parent as a singleDataTransfer
+  //      as well as wellfoundness of the command
+
+  bool P = instruction->preIndexed;
+  bool U = instruction->up;
+  bool L = instruction->load;
+
+  uint32_t Rn = instruction->rn;
+  uint32_t Rd = instruction->rd;
+
+  uint32_t offset = instruction->operand2;
+
+  if (instruction->form != Immediate) {
+    // Offset is interpreted as a shifted register
+    offset = getShiftAmount(state, instruction);
+  }
+
+  // NB: pre indexing will not change the value of the base register, however,
+  // post-indexing will change the contents of the base register by the offset
+  if (P) {
+    // (pre - indexing) the offset is added/subtracted to the base register
+    // before transferring the data
+    transferData(state, L, Rn, Rd, (U ? 1 : -1) * offset);
+  } else {
+    // the offset is added/subtracted to the base register after transferring.
+    transferData(state, L, Rn, Rd, 0);
+    state->registers[Rn] += (U ? 1 : -1) * offset;
+  }
+}
+
+void branch(struct State *state, const struct Instruction *instruction) {
+  state->registers[15] += instruction->offset;
+}
+
+// Fills in the predecoded entry for an instruction word, resolving every
+// field its handler needs so that execution does no further bit extraction.
+void predecode(struct Instruction *instruction, uint32_t word) {
+  void (*instructionType[4])(struct State *, const struct Instruction *) = {
+      dataProcessing, multiply, singleDataTransfer, branch};
+
+  memset(instruction, 0, sizeof(*instruction));
+  instruction->word = word;
+  instruction->type = decode(word);
+  instruction->cond = subByte(word, 31, 4);
+  instruction->rn = subByte(word, 19, 4);
+  instruction->rd = subByte(word, 15, 4);
+  instruction->rs = subByte(word, 11, 4);
+  instruction->rm = subByte(word, 3, 4);
+
+  // Operand2 and the transfer offset share the shifted register encoding.
+  instruction->shiftType = subByte(word, 6, 2);
+  instruction->shiftAmount = subByte(word, 11, 5);
+  instruction->form = bit(word, 4) ? ShiftedByRegister : ShiftedByConstant;
+
+  switch (instruction->type) {
+    case DataProcessing: {
+      instruction->opCode = subByte(word, 24, 4);
+      instruction->setFlags = bit(word, 20);
+      if (bit(word, 25)) {
+        // Operand2 is a rotated immediate value
+        uint32_t contents = subByte(word, 7, 8);
+        uint32_t rotation = 2 * subByte(word, 11, 4);
+        instruction->form = Immediate;
+        instruction->operand2 = shift(contents, rotation, 3);
+        instruction->carry = rotation != 0 && carryOut(contents, rotation, 3);
+        instruction->keepsCarry = rotation == 0;
+      } else {
+        instruction->keepsCarry = instruction->form == ShiftedByConstant &&
+                                  instruction->shiftAmount == 0;
+      }
+      break;
+    }
+    case Multiply: {
+      // Multiply swaps the positions of Rd and Rn
+      instruction->rd = subByte(word, 19, 4);
+      instruction->rn = subByte(word, 15, 4);
+      instruction->accumulate = bit(word, 21);
+      instruction->setFlags = bit(word, 20);
+      break;
+    }
+    case SingleDataTransfer: {
+      instruction->preIndexed = bit(word, 24);
+      instruction->up = bit(word, 23);
+      instruction->load = bit(word, 20);
+      if (!bit(word, 25)) {
+        // Offset is an unsigned 12 bit immediate
+        instruction->form = Immediate;
+        instruction->operand2 = subByte(word, 11, 12);
+      }
+      break;
+    }
+    case Branch: {
+      instruction->offset = subByte(word, 23, 24) << 2;
+      instruction->offset |= bit(word, 23) * 0xfc000000;
+      break;
+    }
+    case Terminate:
+      break;
+  }
+
+  if (instruction->type != Terminate) {
+    instruction->handler = instructionType[instruction->type];
+  }
+  instruction->valid = true;
+}
+
+// Fetch instruction from PC (r15), predecoding it on a cache miss.
+// Addresses past the end of memory read as the halt instruction.
+const struct Instruction *fetch(struct State *state) {
+  uint32_t PC = state->registers[15];
+
+  if (PC >> MEMORY_PAGE_BITS >= state->pageCount) {
+    predecode(&state->outOfRange, 0);
+    return &state->outOfRange;
+  }
+
+  if (state->fetchCode == NULL ||
+      state->fetchNumber != PC >> MEMORY_PAGE_BITS) {
+    state->fetchCode = codePage(state, PC);
+    state->fetchNumber = PC >> MEMORY_PAGE_BITS;
+  }
+  struct Instruction *instruction =
+      &state->fetchCode->cache[PC % MEMORY_PAGE_SIZE / 4];
+  if (!instruction->valid) {
+    predecode(instruction, readWord(state, PC & ~3));
+  }
+  return instruction;
+}
+
+void execute(struct State *state, const struct Instruction *instruction) {
+  // Delegate to the predecoded handler.
+  if (cond(state, instruction->cond)) {
+    instruction->handler(state, instruction);
+  }
+}
+
+// Runs one cycle of the fetch, decode, execute pipeline.
+void cycle(struct State *state) {
+  // Fetch Stage
+  const struct Instruction *newFetched = fetch(state);
+  // Decode Stage
+  enum decodeType newDecodedType = 0;
+  if (state->toDecode != EMPTY_LATCH) {
+    newDecodedType = state->decoding->type;
+  }
+  // Execute Stage
+  if (state->toExecute != EMPTY_LATCH) {
+    execute(state, state->executing);
+  }
+
+  // Update state values for next cycle.
+  // Clear fetch decode pipeline if branch instruction is executed.
+  if (state->decodedType == Branch && cond(state, state->executing->cond)) {
+    state->toDecode = state->toExecute = EMPTY_LATCH;
+    state->decodedType = 0;
+  } else {
+    state->toExecute = state->toDecode;
+    state->executing = state->decoding;
+    state->toDecode = newFetched->word;
+    state->decoding = newFetched;
+    state->decodedType = newDecodedType;
+    // Increment PC by 4 only if not branch.
+    state->registers[15] += 4;
+  }
+}
+
+// Runs pipeline cycles until the pipeline is empty again or the program
+// terminates. Used by the fast engine for code it does not translate.
+void runUntilFlush(struct State *state) {
+  do {
+    cycle(state);
+  } while (state->decodedType != Terminate &&
+           !(state->toDecode == EMPTY_LATCH &&
+             state->toExecute == EMPTY_LATCH));
+}
+
+// Reads the word at an address the way fetch() would.
+uint32_t wordAt(struct State *state, uint32_t address) {
+  uint32_t word = 0;
+  if (address >> MEMORY_PAGE_BITS < state->pageCount) {
+    struct Page *page = PAGE_OF(state, address);
+    if (page != NULL && page->data != NULL) {
+      memcpy(&word, &page->data[address % MEMORY_PAGE_SIZE & ~3], 4);
+    }
+  }
+  return word;
+}
+
+// Instructions that write r15 other than branches depend on the exact
+// pipeline contents, so they are left to the cycle-accurate path.
+bool writesPC(const struct Instruction *instruction) {
+  switch (instruction->type) {
+    case DataProcessing:
+      return instruction->rd == 15 &&
+             (instruction->opCode <= 0x4 || instruction->opCode >= 0xc);
+    case Multiply:
+      return instruction->rd == 15;
+    case SingleDataTransfer:
+      return (instruction->load && instruction->rd == 15) ||
+             (!instruction->preIndexed && instruction->rn == 15);
+    default:
+      return false;
+  }
+}
+
+// Translates the basic block starting at an address, returning NULL if its
+// first instruction cannot be run by the fast engine.
+struct Block *translate(struct State *state, uint32_t start) {
+  struct Block *block = malloc(sizeof(struct Block));
+  if (block == NULL) {
+    perror("Error allocating a basic block.\n");
+    exit(EXIT_FAILURE);
+  }
+  block->start = start;
+  block->length = 0;
+  block->halts = false;
+  block->fallthrough = block->taken = NULL;
+  block->code = NULL;
+
+  uint32_t address = start;
+  while (block->length < MAX_BLOCK_LENGTH) {
+    uint32_t word = wordAt(state, address);
+    if (word == 0) {
+      block->halts = true;
+      break;
+    }
+
+    struct Op *op = &block->ops[block->length];
+    predecode(&op->instruction, word);
+    if (writesPC(&op->instruction)) {
+      break;
+    }
+    op->pc = address + 8;
+    block->length++;
+    address += 4;
+
+    // Branches and stores end the block.
+    if (op->instruction.type == Branch ||
+        (op->instruction.type == SingleDataTransfer &&
+         !op->instruction.load)) {
+      break;
+    }
+  }
+  block->end = address;
+
+  if (block->length == 0 && !block->halts) {
+    free(block);
+    return NULL;
+  }
+  for (uint32_t i = 0; i <= (address - start) / 4; i++) {
+    uint32_t word = start + 4 * i;
+    if (word >> MEMORY_PAGE_BITS < state->pageCount) {
+      codePage(state, word)->translated[word % MEMORY_PAGE_SIZE / 4] = true;
+    }
+  }
+  return block;
+}
+
+// Returns the translated block for an address, translating it if needed.
+struct Block *lookupBlock(struct State *state, uint32_t address) {
+  if (address % 4 != 0 || address >> MEMORY_PAGE_BITS >= state->pageCount) {
+    return NULL;
+  }
+  struct CodePage *code = codePage(state, address);
+  uint32_t index = address % MEMORY_PAGE_SIZE / 4;
+  if (code->blocks[index] == NULL && !code->untranslatable[index]) {
+    code->blocks[index] = translate(state, address);
+    if (code->blocks[index] == NULL) {
+      // Marked as translated too, so a store over the word flushes this.
+      code->untranslatable[index] = true;
+      code->translated[index] = true;
+    } else if (state->jit) {
+      jitCompile(state->jit, code->blocks[index]);
+    }
+  }
+  return code->blocks[index];
+}
+
+// Discards every translated block after a store into translated code.
+void flushBlocks(struct State *state) {
+  for (uint32_t i = 0; i < DIRECTORY_SIZE; i++) {
+    for (uint32_t j = 0; state->pageTable[i] != NULL && j < PAGE_TABLE_SIZE;
+         j++) {
+      struct CodePage *code = state->pageTable[i][j].code;
+      for (uint32_t k = 0; code != NULL && k < MEMORY_PAGE_SIZE / 4; k++) {
+        free(code->blocks[k]);
+        code->blocks[k] = NULL;
+        code->translated[k] = false;
+        code->untranslatable[k] = false;
+      }
+    }
+  }
+  if (state->jit != NULL) {
+    jitReset(state->jit);
+  }
+  state->blocksStale = false;
+}
+
+// Hands the two instructions prefetched behind a store at an address over to
+// the pipeline with their words from before the store, as the cycle-accurate
+// path would execute them, then runs it until it is empty again.
+void handOver(struct State *state, uint32_t address, uint32_t next,
+              uint32_t afterNext) {
+  predecode(&state->prefetched[0], next);
+  predecode(&state->prefetched[1], afterNext);
+  state->toExecute = next;
+  state->executing = &state->prefetched[0];
+  state->toDecode = afterNext;
+  state->decoding = &state->prefetched[1];
+  state->decodedType = next == EMPTY_LATCH ? 0 : state->prefetched[0].type;
+  state->registers[15] = address + 12;
+  if (state->decodedType != Terminate) {
+    runUntilFlush(state);
+  }
+}
+
+// Runs a translated block and returns its successor if it is already known.
+struct Block *runBlock(struct State *state, struct Block *block) {
+  // Blocks that reach the halt instruction run all of their operations,
+  // otherwise the final operation is handled specially below.
+  uint32_t straight = block->halts ? block->length : block->length - 1;
+  bool taken = false;
+
+  if (block->code != NULL) {
+    // Compiled blocks also evaluate a final branch.
+    taken = block->code(state);
+  } else {
+    for (uint32_t i = 0; i < straight; i++) {
+      struct Op *op = &block->ops[i];
+      state->registers[15] = op->pc;
+      execute(state, &op->instruction);
+    }
+  }
+
+  if (block->halts) {
+    // The halt instruction is decoded as the one before it executes.
+    state->registers[15] = block->end + 8;
+    state->decodedType = Terminate;
+    return NULL;
+  }
+
+  struct Op *op = &block->ops[straight];
+  uint32_t address = op->pc - 8;
+
+  if (op->instruction.type == Branch) {
+    if (block->code == NULL) {
+      state->registers[15] = op->pc;
+      taken = cond(state, op->instruction.cond);
+      if (taken) {
+        branch(state, &op->instruction);
+      }
+    }
+    if (taken) {
+      if (block->taken == NULL) {
+        block->taken = lookupBlock(state, state->registers[15]);
+      }
+      return block->taken;
+    }
+  } else if (op->instruction.type == SingleDataTransfer &&
+             !op->instruction.load) {
+    state->registers[15] = op->pc;
+    uint32_t next = wordAt(state, address + 4);
+    uint32_t afterNext = wordAt(state, address + 8);
+    execute(state, &op->instruction);
+    if (next != wordAt(state, address + 4) ||
+        afterNext != wordAt(state, address + 8)) {
+      handOver(state, address, next, afterNext);
+      return NULL;
+    }
+    if (state->blocksStale) {
+      state->registers[15] = block->end;
+      return NULL;
+    }
+  } else {
+    state->registers[15] = op->pc;
+    execute(state, &op->instruction);
+  }
+
+  state->registers[15] = block->end;
+  if (block->fallthrough == NULL) {
+    block->fallthrough = lookupBlock(state, block->end);
+  }
+  return block->fallthrough;
+}
+
+// Runs the program on the fast engine, falling back to the pipeline for
+// anything that is not translated.
+void runFast(struct State *state) {
+  struct Block *block = NULL;
+  while (state->decodedType != Terminate) {
+    if (state->blocksStale) {
+      flushBlocks(state);
+      block = NULL;
+    }
+    if (block == NULL) {
+      block = lookupBlock(state, state->registers[15]);
+    }
+    if (block == NULL) {
+      runUntilFlush(state);
+    } else {
+      block = runBlock(state, block);
+    }
+  }
+}
+
+Machine *machine_new(enum machineEngine engine) {
+  // The decoding tables are shared by every machine.
+  static pthread_once_t tablesBuilt = PTHREAD_ONCE_INIT;
+  pthread_once(&tablesBuilt, buildTables);
+
+  struct State *state = calloc(1, sizeof(struct State));
+  if (state == NULL) {
+    perror("Error allocating machine state.\n");
+    exit(EXIT_FAILURE);
+  }
+  state->pageCount = MACHINE_DEFAULT_MEMORY >> MEMORY_PAGE_BITS;
+  resetProcessor(state);
+  state->fast = engine != PipelineEngine;
+  // Without an executable buffer every block is interpreted.
+  state->jit = engine == JitEngine ? jitInit() : NULL;
+  state->output = stdout;
+  return state;
+}
+
+void machine_free(Machine *state) {
+  freeMemory(state);
+  freeSymbols(state);
+  free(state->gpio);
+  profileFree(state->profile);
+  traceFree(state->trace);
+  jitFree(state->jit);
+  free(state);
+}
+
+bool machine_set_memory_size(Machine *state, uint64_t size) {
+  if (size == 0 || size > MACHINE_MAX_MEMORY) {
+    return false;
+  }
+  clearMemory(state);
+  state->pageCount = (size + MEMORY_PAGE_SIZE - 1) >> MEMORY_PAGE_BITS;
+  return true;
+}
+
+bool machine_map_device(Machine *state, uint32_t base, uint32_t size,
+                        deviceRead read, deviceWrite write, void *context) {
+  uint64_t start = base & ~(MEMORY_PAGE_SIZE - 1);
+  uint64_t end = ((uint64_t)base + size + MEMORY_PAGE_SIZE - 1) &
+                 ~(uint64_t)(MEMORY_PAGE_SIZE - 1);
+  if (size == 0 || state->deviceCount == MAX_DEVICES) {
+    return false;
+  }
+  for (uint32_t i = 0; i < state->deviceCount; i++) {
+    struct Device *other = &state->devices[i];
+    if (start < (uint64_t)other->base + other->size && other->base < end) {
+      return false;
+    }
+  }
+
+  struct Device *device = &state->devices[state->deviceCount++];
+  device->base = base;
+  device->size = end - start - (base - start);
+  device->read = read;
+  device->write = write;
+  device->context = context;
+  mapDevice(state, device);
+  return true;
+}
+
+bool machine_attach_gpio(Machine *state) {
+  if (state->gpio != NULL) {
+    return false;
+  }
+  state->gpio = gpioNew();
+  if (!machine_map_device(state, GPIO_BASE, GPIO_SIZE, gpioRead, gpioWrite,
+                          state->gpio)) {
+    free(state->gpio);
+    state->gpio = NULL;
+    return false;
+  }
+  return true;
+}
+
+// Runs one pipeline cycle through the profiler and the trace recorder,
+// whichever of them are on.
+void instrumentedCycle(struct State *state) {
+  if (state->trace != NULL) {
+    traceBefore(state->trace, state);
+  }
+  if (state->profile != NULL) {
+    profileCycle(state);
+  } else {
+    cycle(state);
+  }
+  if (state->trace != NULL) {
+    traceAfter(state->trace, state);
+  }
+}
+
+uint64_t machine_step(Machine *state, uint64_t cycles) {
+  uint64_t done = 0;
+  if (state->profile != NULL || state->trace != NULL) {
+    for (; done < cycles && state->decodedType != Terminate; done++) {
+      instrumentedCycle(state);
+    }
+    return done;
+  }
+  while (done < cycles && state->decodedType != Terminate) {
+    cycle(state);
+    done++;
+  }
+  return done;
+}
+
+void machine_run(Machine *state) {
+  if (state->profile != NULL || state->trace != NULL) {
+    while (state->decodedType != Terminate) {
+      instrumentedCycle(state);
+    }
+    return;
+  }
+  if (!state->fast) {
+    while (state->decodedType != Terminate) {
+      cycle(state);
+    }
+    return;
+  }
+  // The fast engine starts from an empty pipeline, which machine_step()
+  // may have left half full.
+  if (state->decodedType != Terminate &&
+      !(state->toDecode == EMPTY_LATCH && state->toExecute == EMPTY_LATCH)) {
+    runUntilFlush(state);
+  }
+  runFast(state);
+}
+
+bool machine_halted(const Machine *state) {
+  return state->decodedType == Terminate;
+}
+
+uint32_t machine_register(Machine *state, uint32_t n) {
+  if (n == 16) {
+    materialiseFlags(state);
+  }
+  return n <= 16 ? state->registers[n] : 0;
+}
+
+void machine_set_register(Machine *state, uint32_t n, uint32_t value) {
+  if (n == 16) {
+    // Drop any pending flag update so the new value is not overwritten.
+    materialiseFlags(state);
+  }
+  if (n <= 16) {
+    state->registers[n] = value;
+  }
+}
+
+uint32_t machine_read_word(Machine *state, uint32_t address) {
+  return inBounds(state, address) ? readWord(state, address) : 0;
+}
+
+bool machine_write_word(Machine *state, uint32_t address, uint32_t value) {
+  if (!inBounds(state, address)) {
+    return false;
+  }
+  // Goes through store() so stale predecoded and translated code is dropped.
+  store(state, address, value);
+  return true;
+}
+
+void machine_profile(Machine *state) {
+  if (state->profile == NULL) {
+    state->profile = profileNew();
+  }
+}
+
+void machine_profile_report(Machine *state, FILE *output, size_t hotSpots) {
+  if (state->profile != NULL) {
+    profileReport(state, output, hotSpots);
+  }
+}
+
+const char *machine_symbol(Machine *state, uint32_t address,
+                           uint32_t *offset) {
+  return findSymbol(state, address, offset);
+}
+
+bool machine_trace(Machine *state, const char *fileName, uint64_t ring) {
+  FILE *file = fopen(fileName, "wb");
+  if (file == NULL) {
+    perror(fileName);
+    return false;
+  }
+  traceFree(state->trace);
+  state->trace = traceNew(file, ring);
+  return true;
+}
+
+void machine_set_output(Machine *state, FILE *output) {
+  state->output = output;
+}
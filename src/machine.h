@@ -0,0 +1,116 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Embeddable ARM11 emulator core. Every machine is an independent handle,
+// so any number of them can be created and run concurrently, one thread
+// per machine at a time.
+
+typedef struct State Machine;
+
+// Bounds on the size of a machine's memory, in bytes.
+#define MACHINE_DEFAULT_MEMORY (65536)
+#define MACHINE_MAX_MEMORY (1ULL << 32)
+
+// Enum for the engine a machine executes its program on.
+enum machineEngine {
+  PipelineEngine,
+  FastEngine,
+  JitEngine
+};
+
+// Returns a machine with zeroed memory and registers, or exits if it cannot
+// be allocated. A JitEngine machine falls back to FastEngine when the host
+// cannot run generated code.
+Machine *machine_new(enum machineEngine engine);
+
+void machine_free(Machine *machine);
+
+// Sets the size of memory, rounded up to whole pages, up to 4 GiB. Memory
+// is cleared, so this is done before loading a binary. Returns false for
+// sizes out of range.
+bool machine_set_memory_size(Machine *machine, uint64_t size);
+
+// Clears memory, the registers and the pipeline, and loads a binary into
+// memory from address 0, returning false if the file cannot be read. ELF
+// executables have their loadable segments read to their own addresses
+// instead, start at their entry point and keep their symbols.
+bool machine_load(Machine *machine, const char *fileName);
+
+// Returns the name of the closest symbol of the loaded executable at or
+// before an address, storing the address's offset from it, or NULL if there
+// is none, as for flat binaries.
+const char *machine_symbol(Machine *machine, uint32_t address,
+                           uint32_t *offset);
+
+// Saves the registers, the pipeline and the memory pages that are not all
+// zero to a snapshot file. Devices are not saved.
+bool machine_save(Machine *machine, const char *fileName);
+
+// Replaces the registers, pipeline and memory with those of a snapshot.
+// Its pages are mapped copy-on-write, so any number of machines can resume
+// from one snapshot while sharing the memory none of them has written.
+bool machine_restore(Machine *machine, const char *fileName);
+
+// Runs up to the given number of pipeline cycles on the cycle-accurate
+// engine and returns how many ran before the program terminated.
+uint64_t machine_step(Machine *machine, uint64_t cycles);
+
+// Runs the program on the machine's engine until it terminates.
+void machine_run(Machine *machine);
+
+bool machine_halted(const Machine *machine);
+
+// Registers are numbered 0 to 15, with 16 for the CPSR.
+uint32_t machine_register(Machine *machine, uint32_t n);
+
+void machine_set_register(Machine *machine, uint32_t n, uint32_t value);
+
+// Memory words are little endian, as in the loaded binary. Accesses outside
+// memory read as 0, and writes to them return false.
+uint32_t machine_read_word(Machine *machine, uint32_t address);
+
+bool machine_write_word(Machine *machine, uint32_t address, uint32_t value);
+
+// Callbacks of a memory-mapped device, given the offset of an access from
+// the start of the device.
+typedef uint32_t (*deviceRead)(Machine *machine, void *context,
+                               uint32_t offset);
+typedef void (*deviceWrite)(Machine *machine, void *context, uint32_t offset,
+                            uint32_t value);
+
+// Maps a device over the pages from base to base + size, where loads and
+// stores reach it instead of memory, whether or not memory extends that
+// far. Either callback may be NULL, making reads return 0 or ignoring
+// writes. Returns false if the device overlaps another or too many are
+// mapped.
+bool machine_map_device(Machine *machine, uint32_t base, uint32_t size,
+                        deviceRead read, deviceWrite write, void *context);
+
+// Maps the Raspberry Pi GPIO controller at 0x20200000. Every change of a
+// pin's function or level is logged to the machine's output as it happens.
+bool machine_attach_gpio(Machine *machine);
+
+// Starts counting executed instructions by address and class, along with
+// branch and condition outcomes. Profiled machines run on the
+// cycle-accurate engine, whichever engine they were created with.
+void machine_profile(Machine *machine);
+
+// Prints the profile totals and the given number of most executed
+// addresses, named after the closest symbol when there is one.
+void machine_profile_report(Machine *machine, FILE *output, size_t hotSpots);
+
+// Records every instruction the machine executes from now on, with the
+// registers it changes and the words it stores, to a trace file that
+// tracedump reads. With a ring other than 0 only the last ring instructions
+// are kept. Traced machines run on the cycle-accurate engine, and the trace
+// is complete once the machine is freed. Returns false if the file cannot be
+// created.
+bool machine_trace(Machine *machine, const char *fileName, uint64_t ring);
+
+// Where the machine reports out of bounds accesses, stdout by default.
+void machine_set_output(Machine *machine, FILE *output);
+
+// Prints the registers and non-zero memory.
+void machine_dump(Machine *machine, FILE *output);
@@ -0,0 +1,105 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "opcodes.h"
+
+// Packs the characters of a short word into one integer to switch on.
+#define PACK2(a, b) ((uint32_t) (a) | (uint32_t) (b) << 8)
+#define PACK3(a, b, c) (PACK2(a, b) | (uint32_t) (c) << 16)
+
+// Condition code used when an instruction has no suffix.
+#define ALWAYS (14)
+
+static uint32_t pack(const char *text, size_t length) {
+  uint32_t packed = 0;
+  for (size_t i = 0; i < length; i++) {
+    packed |= (uint32_t) (uint8_t) text[i] << (8 * i);
+  }
+  return packed;
+}
+
+int recogniseCondition(const char *text, size_t length) {
+  if (length != 2) {
+    return -1;
+  }
+  switch (pack(text, 2)) {
+    case PACK2('e', 'q'): return 0;  // 0000
+    case PACK2('n', 'e'): return 1;  // 0001
+    case PACK2('g', 'e'): return 10; // 1010
+    case PACK2('l', 't'): return 11; // 1011
+    case PACK2('g', 't'): return 12; // 1100
+    case PACK2('l', 'e'): return 13; // 1101
+    case PACK2('a', 'l'): return 14; // 1110
+    default: return -1;
+  }
+}
+
+int recogniseShift(const char *text, size_t length) {
+  if (length != 3) {
+    return -1;
+  }
+  switch (pack(text, 3)) {
+    case PACK3('l', 's', 'l'): return 0; // 00
+    case PACK3('l', 's', 'r'): return 1; // 01
+    case PACK3('a', 's', 'r'): return 2; // 10
+    case PACK3('r', 'o', 'r'): return 3; // 11
+    default: return -1;
+  }
+}
+
+// Data processing mnemonics with their opcodes, and the other classes.
+static bool recogniseThree(uint32_t packed, struct Mnemonic *mnemonic) {
+  mnemonic->kind = DataProcessingMnemonic;
+  switch (packed) {
+    case PACK3('a', 'n', 'd'): mnemonic->opcode = 0; return true;  // 0000
+    case PACK3('e', 'o', 'r'): mnemonic->opcode = 1; return true;  // 0001
+    case PACK3('s', 'u', 'b'): mnemonic->opcode = 2; return true;  // 0010
+    case PACK3('r', 's', 'b'): mnemonic->opcode = 3; return true;  // 0011
+    case PACK3('a', 'd', 'd'): mnemonic->opcode = 4; return true;  // 0100
+    case PACK3('t', 's', 't'): mnemonic->opcode = 8; return true;  // 1000
+    case PACK3('t', 'e', 'q'): mnemonic->opcode = 9; return true;  // 1001
+    case PACK3('c', 'm', 'p'): mnemonic->opcode = 10; return true; // 1010
+    case PACK3('o', 'r', 'r'): mnemonic->opcode = 12; return true; // 1100
+    case PACK3('m', 'o', 'v'): mnemonic->opcode = 13; return true; // 1101
+    case PACK3('m', 'v', 'n'): mnemonic->opcode = 15; return true; // 1111
+    case PACK3('m', 'l', 'a'):
+      mnemonic->opcode = 1;
+      // fall through
+    case PACK3('m', 'u', 'l'):
+      mnemonic->kind = MultiplyMnemonic;
+      return true;
+    case PACK3('l', 'd', 'r'):
+      mnemonic->opcode = 1;
+      // fall through
+    case PACK3('s', 't', 'r'):
+      mnemonic->kind = TransferMnemonic;
+      return true;
+    case PACK3('l', 's', 'l'):
+      mnemonic->kind = SpecialMnemonic;
+      mnemonic->opcode = 1;
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool recogniseMnemonic(const char *text, size_t length,
+                       struct Mnemonic *mnemonic) {
+  mnemonic->opcode = 0;
+  mnemonic->cond = ALWAYS;
+
+  if (text[0] == 'b' && (length == 1 || length == 3)) {
+    int cond = length == 1 ? ALWAYS : recogniseCondition(&text[1], 2);
+    mnemonic->kind = BranchMnemonic;
+    mnemonic->cond = cond;
+    return cond >= 0;
+  }
+  if (length == 3) {
+    return recogniseThree(pack(text, 3), mnemonic);
+  }
+  if (length == 5 && memcmp(text, "andeq", 5) == 0) {
+    mnemonic->kind = SpecialMnemonic;
+    return true;
+  }
+  return false;
+}
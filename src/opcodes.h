@@ -0,0 +1,35 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Recognisers for the fixed vocabulary of the assembly language: mnemonics,
+// condition suffixes and shift names. Each switches on the length and
+// characters of the word, so recognising one allocates and copies nothing,
+// and the symbol table is left to hold only labels.
+
+// Enum for the instruction class a mnemonic is assembled by.
+enum mnemonicKind {
+  SpecialMnemonic,
+  MultiplyMnemonic,
+  TransferMnemonic,
+  BranchMnemonic,
+  DataProcessingMnemonic
+};
+
+// A recognised mnemonic with its data processing opcode, or 1 for mla, ldr
+// and lsl, and the condition code of a branch. Words are given as a pointer
+// and a length, so they need not be terminated.
+struct Mnemonic {
+  enum mnemonicKind kind;
+  uint32_t opcode;
+  uint32_t cond;
+};
+
+bool recogniseMnemonic(const char *text, size_t length,
+                       struct Mnemonic *mnemonic);
+
+// Returns the condition code of a suffix such as "ne", or -1.
+int recogniseCondition(const char *text, size_t length);
+
+// Returns the code of a shift name such as "lsr", or -1.
+int recogniseShift(const char *text, size_t length);
@@ -0,0 +1,263 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "emulate.h"
+#include "paging.h"
+
+#define PAGE_OFFSET(address) ((address) & (MEMORY_PAGE_SIZE - 1))
+
+// Returns the page holding an address, or NULL if the second-level table
+// covering it has not been allocated.
+struct Page *findPage(struct State *state, uint32_t address) {
+  if (RECENT(state, address)) {
+    return state->recentPage;
+  }
+  struct Page *table = state->pageTable[address >> PAGE_TABLE_SHIFT];
+  if (table == NULL) {
+    return NULL;
+  }
+  state->recentNumber = address >> MEMORY_PAGE_BITS;
+  state->recentPage =
+      &table[(address >> MEMORY_PAGE_BITS) & (PAGE_TABLE_SIZE - 1)];
+  return state->recentPage;
+}
+
+struct Page *allocatePage(struct State *state, uint32_t address) {
+  if (RECENT(state, address)) {
+    return state->recentPage;
+  }
+  struct Page **table = &state->pageTable[address >> PAGE_TABLE_SHIFT];
+  if (*table == NULL) {
+    *table = calloc(PAGE_TABLE_SIZE, sizeof(struct Page));
+    if (*table == NULL) {
+      perror("Error allocating a page table.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  state->recentNumber = address >> MEMORY_PAGE_BITS;
+  state->recentPage =
+      &(*table)[(address >> MEMORY_PAGE_BITS) & (PAGE_TABLE_SIZE - 1)];
+  return state->recentPage;
+}
+
+// Returns the predecoded and translated code of the page holding an
+// address, allocating it the first time the page is executed from.
+struct CodePage *codePage(struct State *state, uint32_t address) {
+  struct Page *page = allocatePage(state, address);
+  if (page->code == NULL) {
+    page->code = calloc(1, sizeof(struct CodePage));
+    if (page->code == NULL) {
+      perror("Error allocating a code page.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return page->code;
+}
+
+static uint8_t *pageData(struct Page *page) {
+  if (page->data == NULL) {
+    page->data = calloc(1, MEMORY_PAGE_SIZE);
+    if (page->data == NULL) {
+      perror("Error allocating a page.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return page->data;
+}
+
+// Whether all four bytes of a word lie in memory. Memory is a whole number
+// of pages, so checking the page of the last byte is exact.
+bool inBounds(const struct State *state, uint32_t address) {
+  return ((uint64_t)address + 3) >> MEMORY_PAGE_BITS < state->pageCount;
+}
+
+static uint8_t readByte(struct State *state, uint32_t address) {
+  const struct Page *page = findPage(state, address);
+  if (page == NULL || page->data == NULL) {
+    return 0;
+  }
+  return page->data[PAGE_OFFSET(address)];
+}
+
+// Reads a little-endian word. Words straddling two pages are put together
+// a byte at a time.
+uint32_t readWord(struct State *state, uint32_t address) {
+  uint32_t offset = PAGE_OFFSET(address);
+  uint32_t word = 0;
+  if (offset <= MEMORY_PAGE_SIZE - 4) {
+    struct Page *page = PAGE_OF(state, address);
+    if (page != NULL && page->data != NULL) {
+      memcpy(&word, &page->data[offset], 4);
+    }
+    return word;
+  }
+  for (int i = 3; i >= 0; i--) {
+    word = word << 8 | readByte(state, address + i);
+  }
+  return word;
+}
+
+void writeWord(struct State *state, uint32_t address, uint32_t value) {
+  uint32_t offset = PAGE_OFFSET(address);
+  if (offset <= MEMORY_PAGE_SIZE - 4) {
+    struct Page *page = RECENT(state, address) ? state->recentPage
+                                               : allocatePage(state, address);
+    uint8_t *data = page->data != NULL ? page->data : pageData(page);
+    memcpy(&data[offset], &value, 4);
+    return;
+  }
+  for (int i = 0; i < 4; i++) {
+    uint8_t *data = pageData(allocatePage(state, address + i));
+    data[PAGE_OFFSET(address + i)] = value >> 8 * i;
+  }
+}
+
+// Maps the first size bytes of a file, without putting any of them in
+// memory yet. The mapping is private, so pages pointed into it are only
+// copied once they are written.
+bool mapFile(struct State *state, int fd, size_t size) {
+  void *image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (image == MAP_FAILED) {
+    return false;
+  }
+  state->image = image;
+  state->imageSize = size;
+  return true;
+}
+
+// Maps the first size bytes of a file as the initial contents of memory.
+bool mapImage(struct State *state, int fd, size_t size) {
+  if (!mapFile(state, fd, size)) {
+    return false;
+  }
+  for (size_t offset = 0; offset < size; offset += MEMORY_PAGE_SIZE) {
+    allocatePage(state, offset)->data = &state->image[offset];
+  }
+  return true;
+}
+
+// Points memory from a page aligned address at the whole pages of size
+// bytes of the mapped file from a page aligned offset, returning how many
+// bytes that covers. The part of a page left over is not mapped, since the
+// rest of it would show the bytes after it in the file. Nothing is mapped
+// if the bytes do not all fit in memory.
+uint32_t mapSegment(struct State *state, uint32_t offset, uint32_t address,
+                    uint32_t size) {
+  if ((uint64_t)address + size >
+          (uint64_t)state->pageCount << MEMORY_PAGE_BITS ||
+      (uint64_t)offset + size > state->imageSize) {
+    return 0;
+  }
+  uint32_t whole = size & ~(uint32_t)(MEMORY_PAGE_SIZE - 1);
+  for (uint32_t i = 0; i < whole; i += MEMORY_PAGE_SIZE) {
+    allocatePage(state, address + i)->data = &state->image[offset + i];
+  }
+  return whole;
+}
+
+// Maps count pages stored one after another in a file from offset, the
+// i-th of them as page numbers[i] of memory. Like the image of a binary,
+// the mapping is private, so every machine that maps the same file shares
+// the pages until it writes them.
+bool mapPages(struct State *state, int fd, off_t offset,
+              const uint32_t *numbers, uint32_t count) {
+  size_t size = (size_t)count * MEMORY_PAGE_SIZE;
+  void *image =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+  if (image == MAP_FAILED) {
+    return false;
+  }
+  state->image = image;
+  state->imageSize = size;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t address = numbers[i] << MEMORY_PAGE_BITS;
+    allocatePage(state, address)->data = &state->image[i * MEMORY_PAGE_SIZE];
+  }
+  return true;
+}
+
+// Reads a stream that cannot be mapped into memory a page at a time,
+// returning the number of bytes read.
+size_t readImage(struct State *state, FILE *fp) {
+  uint64_t memorySize = (uint64_t)state->pageCount << MEMORY_PAGE_BITS;
+  uint64_t size = 0;
+  while (size < memorySize) {
+    uint8_t buffer[MEMORY_PAGE_SIZE];
+    size_t read = fread(buffer, 1, sizeof(buffer), fp);
+    if (read == 0) {
+      break;
+    }
+    memcpy(pageData(allocatePage(state, size)), buffer, read);
+    size += read;
+  }
+  return size;
+}
+
+// Reads size bytes of a stream into memory from an address on, a page at a
+// time, returning false if they do not all fit or the stream ends first.
+bool readSegment(struct State *state, FILE *fp, uint32_t address,
+                 uint32_t size) {
+  if (size > 0 && ((uint64_t)address + size - 1) >> MEMORY_PAGE_BITS >=
+                      state->pageCount) {
+    return false;
+  }
+  while (size > 0) {
+    uint32_t offset = PAGE_OFFSET(address);
+    uint32_t chunk = MEMORY_PAGE_SIZE - offset < size
+                         ? MEMORY_PAGE_SIZE - offset
+                         : size;
+    uint8_t *data = pageData(allocatePage(state, address));
+    if (fread(&data[offset], 1, chunk, fp) != chunk) {
+      return false;
+    }
+    address += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+
+// Points the pages a device covers at it.
+void mapDevice(struct State *state, struct Device *device) {
+  for (uint64_t address = device->base;
+       address < (uint64_t)device->base + device->size;
+       address += MEMORY_PAGE_SIZE) {
+    allocatePage(state, address)->device = device;
+  }
+}
+
+// Releases every page, along with the code predecoded and translated from
+// it, leaving memory all zero.
+void freeMemory(struct State *state) {
+  for (uint32_t i = 0; i < DIRECTORY_SIZE; i++) {
+    struct Page *table = state->pageTable[i];
+    if (table == NULL) {
+      continue;
+    }
+    for (uint32_t j = 0; j < PAGE_TABLE_SIZE; j++) {
+      struct Page *page = &table[j];
+      if (page->data < state->image ||
+          page->data >= state->image + state->imageSize) {
+        free(page->data);
+      }
+      if (page->code != NULL) {
+        for (uint32_t k = 0; k < MEMORY_PAGE_SIZE / 4; k++) {
+          free(page->code->blocks[k]);
+        }
+        free(page->code);
+      }
+    }
+    free(table);
+    state->pageTable[i] = NULL;
+  }
+  state->recentPage = NULL;
+  state->fetchCode = NULL;
+  if (state->image != NULL) {
+    munmap(state->image, state->imageSize);
+    state->image = NULL;
+    state->imageSize = 0;
+  }
+}
@@ -0,0 +1,50 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// Guest memory as a two-level table of pages, allocated on demand. Pages
+// that were never loaded or written have no data and read as zero.
+
+struct State;
+
+#define RECENT(state, address)        \
+  ((state)->recentPage != NULL &&     \
+   (state)->recentNumber == (address) >> MEMORY_PAGE_BITS)
+
+// The page holding an address, without a call when it is the page of the
+// latest access.
+#define PAGE_OF(state, address) \
+  (RECENT(state, address) ? (state)->recentPage : findPage(state, address))
+
+struct Page *findPage(struct State *state, uint32_t address);
+
+struct Page *allocatePage(struct State *state, uint32_t address);
+
+struct CodePage *codePage(struct State *state, uint32_t address);
+
+bool inBounds(const struct State *state, uint32_t address);
+
+uint32_t readWord(struct State *state, uint32_t address);
+
+void writeWord(struct State *state, uint32_t address, uint32_t value);
+
+bool mapFile(struct State *state, int fd, size_t size);
+
+bool mapImage(struct State *state, int fd, size_t size);
+
+uint32_t mapSegment(struct State *state, uint32_t offset, uint32_t address,
+                    uint32_t size);
+
+bool mapPages(struct State *state, int fd, off_t offset,
+              const uint32_t *numbers, uint32_t count);
+
+size_t readImage(struct State *state, FILE *fp);
+
+bool readSegment(struct State *state, FILE *fp, uint32_t address,
+                 uint32_t size);
+
+void mapDevice(struct State *state, struct Device *device);
+
+void freeMemory(struct State *state);
@@ -0,0 +1,314 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "peephole.h"
+#include "utils.h"
+
+// Condition code of an instruction that always runs.
+#define ALWAYS (14)
+#define PC (15)
+
+// Enum for what a word of the image is, as far as moving it goes.
+enum irKind {
+  PlainIr,
+  BranchIr,
+  LoadIr,
+  DataIr
+};
+
+// A decoded word. Branches and literal loads keep the index of the word
+// they go to or read, which stays right however many words are removed.
+struct Ir {
+  enum irKind kind;
+  uint32_t word;
+  int target;
+  // Whether a branch goes here, so no instruction may be folded into the
+  // one before it.
+  bool targeted;
+  bool removed;
+};
+
+// Data processing opcodes the pass reads or writes.
+enum dataOpcode {
+  AndOpcode = 0,
+  EorOpcode = 1,
+  SubOpcode = 2,
+  RsbOpcode = 3,
+  AddOpcode = 4,
+  OrrOpcode = 12,
+  MovOpcode = 13,
+  MvnOpcode = 15
+};
+
+static bool isBranch(uint32_t word) {
+  return subByte(word, 27, 3) == 5; // 101
+}
+
+static bool isTransfer(uint32_t word) {
+  return subByte(word, 27, 2) == 1; // 01
+}
+
+static bool isMultiply(uint32_t word) {
+  return subByte(word, 27, 6) == 0 && subByte(word, 7, 4) == 9; // 1001
+}
+
+// Whether the word is an ldr of the form [r15,#offset] into a register
+// other than the pc, as literals are loaded, with a whole number of words
+// for its offset.
+static bool isLiteralLoad(uint32_t word) {
+  return isTransfer(word) && !bit(word, 25) && bit(word, 24) &&
+         !bit(word, 21) && bit(word, 20) && subByte(word, 19, 4) == PC &&
+         subByte(word, 15, 4) != PC && subByte(word, 11, 12) % 4 == 0;
+}
+
+// Whether the instruction names the pc as any of its registers.
+static bool usesPc(uint32_t word) {
+  if (isBranch(word)) {
+    return false;
+  }
+  if (isMultiply(word)) {
+    return subByte(word, 19, 4) == PC || subByte(word, 15, 4) == PC ||
+           subByte(word, 11, 4) == PC || subByte(word, 3, 4) == PC;
+  }
+  if (subByte(word, 19, 4) == PC || subByte(word, 15, 4) == PC) {
+    return true;
+  }
+  if (isTransfer(word)) {
+    return bit(word, 25) && subByte(word, 3, 4) == PC;
+  }
+  // Data processing with a register operand, shifted by a register or not.
+  return !bit(word, 25) && (subByte(word, 3, 4) == PC ||
+                            (bit(word, 4) && subByte(word, 11, 4) == PC));
+}
+
+// Whether the word is data processing with an immediate operand that does
+// not set the flags, and so can be rewritten freely.
+static bool isImmediateOperation(const struct Ir *ir) {
+  return ir->kind == PlainIr && subByte(ir->word, 27, 2) == 0 &&
+         bit(ir->word, 25) && !bit(ir->word, 20) &&
+         subByte(ir->word, 15, 4) != PC;
+}
+
+static uint32_t immediateValue(uint32_t word) {
+  return (uint32_t) rotateRight(subByte(word, 7, 8), subByte(word, 11, 4) * 2);
+}
+
+// Rewrites an immediate operation as another opcode and immediate, returning
+// false if the immediate cannot be encoded.
+static bool reencode(struct Ir *ir, enum dataOpcode opcode, uint32_t value) {
+  uint32_t operand2;
+  if (!encodeImmediate(value, &operand2)) {
+    return false;
+  }
+  setBits(&ir->word, opcode, 24, 4);
+  setBits(&ir->word, operand2, 11, 12);
+  return true;
+}
+
+// Whether the instruction does nothing: a move of a register to itself, or
+// adding, subtracting, or-ing or eor-ing 0 into it.
+static bool isDead(const struct Ir *ir) {
+  uint32_t word = ir->word;
+  if (ir->kind != PlainIr || subByte(word, 27, 2) != 0 || bit(word, 20)) {
+    return false;
+  }
+  uint32_t opcode = subByte(word, 24, 4);
+  uint32_t rd = subByte(word, 15, 4);
+  if (!bit(word, 25)) {
+    return opcode == MovOpcode && subByte(word, 11, 8) == 0 &&
+           subByte(word, 3, 4) == rd;
+  }
+  return (opcode == AddOpcode || opcode == SubOpcode ||
+          opcode == OrrOpcode || opcode == EorOpcode) &&
+         subByte(word, 19, 4) == rd && immediateValue(word) == 0;
+}
+
+// Returns the first word from index on that has not been removed.
+static int live(const struct Ir *ir, int count, int index) {
+  while (index < count && ir[index].removed) {
+    index++;
+  }
+  return index;
+}
+
+// Folds the operation after a move or an add of a constant into it, where
+// nothing can run between the two and the result is still an immediate:
+//   mov r1,#1 ; add r1,r1,#2     becomes   mov r1,#3
+//   add r1,r2,#4 ; sub r1,r1,#1  becomes   add r1,r2,#3
+static bool fold(struct Ir *ir, int count, int first) {
+  struct Ir *into = &ir[first];
+  int next = live(ir, count, first + 1);
+  for (int i = first + 1; i <= next && i < count; i++) {
+    if (ir[i].targeted) {
+      return false;
+    }
+  }
+  if (next == count || !isImmediateOperation(&ir[next])) {
+    return false;
+  }
+  struct Ir *from = &ir[next];
+  uint32_t rd = subByte(into->word, 15, 4);
+  if (subByte(from->word, 31, 4) != subByte(into->word, 31, 4) ||
+      subByte(from->word, 15, 4) != rd || subByte(from->word, 19, 4) != rd) {
+    return false;
+  }
+
+  uint32_t opcode = subByte(into->word, 24, 4);
+  uint32_t operation = subByte(from->word, 24, 4);
+  uint32_t a = immediateValue(into->word);
+  uint32_t b = immediateValue(from->word);
+  struct Ir folded = *into;
+  if (opcode == MovOpcode || opcode == MvnOpcode) {
+    uint32_t value = opcode == MovOpcode ? a : ~a;
+    switch (operation) {
+      case AndOpcode: value &= b; break;
+      case EorOpcode: value ^= b; break;
+      case SubOpcode: value -= b; break;
+      case RsbOpcode: value = b - value; break;
+      case AddOpcode: value += b; break;
+      case OrrOpcode: value |= b; break;
+      default: return false;
+    }
+    if (!reencode(&folded, MovOpcode, value) &&
+        !reencode(&folded, MvnOpcode, ~value)) {
+      return false;
+    }
+  } else if ((opcode == AddOpcode || opcode == SubOpcode) &&
+             (operation == AddOpcode || operation == SubOpcode) &&
+             subByte(into->word, 19, 4) != PC) {
+    uint32_t sum = (opcode == AddOpcode ? a : -a) +
+                   (operation == AddOpcode ? b : -b);
+    if (!reencode(&folded, AddOpcode, sum) &&
+        !reencode(&folded, SubOpcode, -sum)) {
+      return false;
+    }
+  } else {
+    return false;
+  }
+  *into = folded;
+  from->removed = true;
+  return true;
+}
+
+// Follows a branch through unconditional branches, and those with its own
+// condition, to where it ends up.
+static int thread(const struct Ir *ir, int count, int branch) {
+  uint32_t cond = subByte(ir[branch].word, 31, 4);
+  int target = live(ir, count, ir[branch].target);
+  // Bounded, as branches can go round in a loop.
+  for (int hops = 0; hops < count && target < count; hops++) {
+    const struct Ir *next = &ir[target];
+    uint32_t nextCond = subByte(next->word, 31, 4);
+    if (next->kind != BranchIr || target == branch ||
+        (nextCond != ALWAYS && nextCond != cond)) {
+      break;
+    }
+    target = live(ir, count, next->target);
+  }
+  return target;
+}
+
+// Decodes the image, returning false if it has to be left as it is.
+static bool decode(struct Ir *ir, const uint32_t *code, const bool *data,
+                   int count) {
+  for (int i = 0; i < count; i++) {
+    struct Ir *decoded = &ir[i];
+    uint32_t word = code[i];
+    decoded->word = word;
+    if (data[i]) {
+      decoded->kind = DataIr;
+      continue;
+    }
+    if (isBranch(word)) {
+      int32_t offset = (int32_t) (word << 8) >> 8;
+      decoded->kind = BranchIr;
+      decoded->target = i + 2 + offset;
+    } else if (isLiteralLoad(word)) {
+      int offset = subByte(word, 11, 12) / 4;
+      decoded->kind = LoadIr;
+      decoded->target = i + 2 + (bit(word, 23) ? offset : -offset);
+      // Only loads from a pool word, which is never removed, can follow
+      // it when code moves.
+      if (decoded->target < 0 || decoded->target >= count ||
+          !data[decoded->target]) {
+        return false;
+      }
+    } else if (usesPc(word)) {
+      return false;
+    }
+    if (decoded->kind != PlainIr &&
+        (decoded->target < 0 || decoded->target > count)) {
+      return false;
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    if (ir[i].kind == BranchIr) {
+      ir[ir[i].target].targeted = true;
+    }
+  }
+  return true;
+}
+
+int optimise(uint32_t *code, bool *data, int count, int *moved) {
+  for (int i = 0; i <= count; i++) {
+    moved[i] = i;
+  }
+  struct Ir *ir = calloc(count + 1, sizeof(struct Ir));
+  if (ir == NULL) {
+    perror("Error allocating the optimiser's instructions.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!decode(ir, code, data, count)) {
+    free(ir);
+    return count;
+  }
+
+  // Dead instructions go first, so folding can see past them.
+  for (int i = 0; i < count; i++) {
+    ir[i].removed = isDead(&ir[i]);
+  }
+  for (int i = 0; i < count; i++) {
+    if (!ir[i].removed && isImmediateOperation(&ir[i])) {
+      while (fold(ir, count, i)) {
+      }
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    if (!ir[i].removed && ir[i].kind == BranchIr) {
+      ir[i].target = thread(ir, count, i);
+    }
+  }
+  // From the end, so a branch over branches that are themselves removed
+  // is seen to go to the next instruction.
+  for (int i = count - 1; i >= 0; i--) {
+    if (!ir[i].removed && ir[i].kind == BranchIr &&
+        live(ir, count, ir[i].target) == live(ir, count, i + 1)) {
+      ir[i].removed = true;
+    }
+  }
+
+  // A removed word moves to where the next word left ends up.
+  int left = 0;
+  for (int i = 0; i <= count; i++) {
+    moved[i] = left;
+    left += i < count && !ir[i].removed;
+  }
+  left = 0;
+  for (int i = 0; i < count; i++) {
+    struct Ir *kept = &ir[i];
+    if (kept->removed) {
+      continue;
+    }
+    if (kept->kind == BranchIr) {
+      setBits(&kept->word, moved[kept->target] - moved[i] - 2, 23, 24);
+    } else if (kept->kind == LoadIr) {
+      int offset = (moved[kept->target] - moved[i]) * 4 - 8;
+      setBits(&kept->word, offset >= 0, 23, 1);
+      setBits(&kept->word, abs(offset), 11, 12);
+    }
+    data[left] = kept->kind == DataIr;
+    code[left++] = kept->word;
+  }
+  free(ir);
+  return left;
+}
@@ -0,0 +1,16 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+// Peephole optimiser over an assembled image. Instructions are decoded
+// into a list that knows which words branch or load from where, so any
+// number can be removed and every branch and literal load given its new
+// offset afterwards.
+
+// Optimises count words in place, of which those marked in data belong to
+// literal pools, and returns how many words are left. The marks are moved
+// along with the words, and moved, which has room for count + 1 indices, is
+// filled with the index each word and the end of the image end up at, so
+// labels can be moved too. Images with an instruction that reads or writes
+// the pc other than a literal load are left as they are, since moving code
+// would change what it sees.
+int optimise(uint32_t *code, bool *data, int count, int *moved);
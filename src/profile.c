@@ -0,0 +1,178 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "elfLoader.h"
+#include "emulate.h"
+#include "profile.h"
+
+#define INITIAL_COUNTERS (1024)
+
+// How often the instruction at an address ran, and the word it last had.
+struct Counter {
+  uint32_t pc;
+  uint32_t word;
+  uint64_t count;
+};
+
+// Counters are kept in an open addressing table keyed by address, with a
+// count of zero marking an empty slot.
+struct Profile {
+  struct Counter *counters;
+  size_t capacity;
+  size_t used;
+  uint64_t total;
+  uint64_t classes[Terminate];
+  uint64_t failed;
+  uint64_t taken;
+  uint64_t notTaken;
+};
+
+static struct Counter *allocateCounters(size_t capacity) {
+  struct Counter *counters = calloc(capacity, sizeof(struct Counter));
+  if (counters == NULL) {
+    perror("Error allocating profile counters.\n");
+    exit(EXIT_FAILURE);
+  }
+  return counters;
+}
+
+struct Profile *profileNew(void) {
+  struct Profile *profile = calloc(1, sizeof(struct Profile));
+  if (profile == NULL) {
+    perror("Error allocating a profile.\n");
+    exit(EXIT_FAILURE);
+  }
+  profile->capacity = INITIAL_COUNTERS;
+  profile->counters = allocateCounters(profile->capacity);
+  return profile;
+}
+
+void profileFree(struct Profile *profile) {
+  if (profile != NULL) {
+    free(profile->counters);
+    free(profile);
+  }
+}
+
+static struct Counter *findCounter(struct Counter *counters, size_t capacity,
+                                   uint32_t pc) {
+  size_t slot = (pc / 4 * 2654435761u) & (capacity - 1);
+  while (counters[slot].count != 0 && counters[slot].pc != pc) {
+    slot = (slot + 1) & (capacity - 1);
+  }
+  return &counters[slot];
+}
+
+// Doubles the table once it is half full.
+static void grow(struct Profile *profile) {
+  size_t capacity = profile->capacity * 2;
+  struct Counter *counters = allocateCounters(capacity);
+  for (size_t i = 0; i < profile->capacity; i++) {
+    if (profile->counters[i].count != 0) {
+      *findCounter(counters, capacity, profile->counters[i].pc) =
+          profile->counters[i];
+    }
+  }
+  free(profile->counters);
+  profile->counters = counters;
+  profile->capacity = capacity;
+}
+
+// Runs one pipeline cycle, first counting the instruction it is about to
+// execute. The plain engines never come through here, so they pay nothing
+// for profiling.
+void profileCycle(struct State *state) {
+  struct Profile *profile = state->profile;
+  if (state->toExecute != EMPTY_LATCH) {
+    const struct Instruction *instruction = state->executing;
+    uint32_t pc = state->registers[15] - 8;
+    bool passes = cond(state, instruction->cond);
+
+    struct Counter *counter =
+        findCounter(profile->counters, profile->capacity, pc);
+    if (counter->count == 0) {
+      if (2 * (profile->used + 1) > profile->capacity) {
+        grow(profile);
+        counter = findCounter(profile->counters, profile->capacity, pc);
+      }
+      counter->pc = pc;
+      profile->used++;
+    }
+    counter->word = instruction->word;
+    counter->count++;
+
+    profile->total++;
+    profile->classes[instruction->type]++;
+    if (!passes) {
+      profile->failed++;
+    }
+    if (instruction->type == Branch) {
+      if (passes) {
+        profile->taken++;
+      } else {
+        profile->notTaken++;
+      }
+    }
+  }
+  cycle(state);
+}
+
+static int byCount(const void *a, const void *b) {
+  const struct Counter *x = a;
+  const struct Counter *y = b;
+  if (x->count != y->count) {
+    return x->count < y->count ? 1 : -1;
+  }
+  return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+// Prints the totals, then the most executed addresses with their share of
+// all instructions and the instruction word found there.
+void profileReport(const struct State *state, FILE *output,
+                   size_t hotSpots) {
+  const struct Profile *profile = state->profile;
+  static const char *classes[Terminate] = {"Data processing", "Multiply",
+                                           "Single data transfer", "Branch"};
+  double total = profile->total > 0 ? profile->total : 1;
+
+  fprintf(output, "Profile:\n");
+  fprintf(output, "Instructions        : %llu\n",
+          (unsigned long long)profile->total);
+  for (int i = 0; i < Terminate; i++) {
+    fprintf(output, "  %-20s: %llu\n", classes[i],
+            (unsigned long long)profile->classes[i]);
+  }
+  fprintf(output, "Condition failed    : %llu\n",
+          (unsigned long long)profile->failed);
+  fprintf(output, "Branches taken      : %llu\n",
+          (unsigned long long)profile->taken);
+  fprintf(output, "Branches not taken  : %llu\n",
+          (unsigned long long)profile->notTaken);
+
+  struct Counter *sorted = allocateCounters(profile->used + 1);
+  size_t count = 0;
+  for (size_t i = 0; i < profile->capacity; i++) {
+    if (profile->counters[i].count != 0) {
+      sorted[count++] = profile->counters[i];
+    }
+  }
+  qsort(sorted, count, sizeof(struct Counter), byCount);
+
+  fprintf(output, "Hot spots:\n");
+  for (size_t i = 0; i < count && i < hotSpots; i++) {
+    fprintf(output, "0x%08x: 0x%08x %12llu %6.2f%%", sorted[i].pc,
+            sorted[i].word, (unsigned long long)sorted[i].count,
+            100 * sorted[i].count / total);
+    uint32_t offset;
+    const char *symbol = findSymbol(state, sorted[i].pc, &offset);
+    if (symbol != NULL && offset == 0) {
+      fprintf(output, " <%s>", symbol);
+    } else if (symbol != NULL) {
+      fprintf(output, " <%s+0x%x>", symbol, offset);
+    }
+    fprintf(output, "\n");
+  }
+  free(sorted);
+}
@@ -0,0 +1,17 @@
+#include <stddef.h>
+#include <stdio.h>
+
+// Execution profile of a machine: how often each instruction ran, broken
+// down by address and by class, with branch and condition outcomes.
+
+struct Profile;
+struct State;
+
+struct Profile *profileNew(void);
+
+void profileFree(struct Profile *profile);
+
+void profileCycle(struct State *state);
+
+void profileReport(const struct State *state, FILE *output,
+                   size_t hotSpots);
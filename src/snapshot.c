@@ -0,0 +1,197 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "emulate.h"
+#include "machine.h"
+#include "paging.h"
+
+#define SNAPSHOT_MAGIC ("ARMSNAP")
+#define SNAPSHOT_VERSION (2)
+
+// A snapshot file is this header, the numbers of the pages it stores, and
+// then the pages themselves from dataOffset. The offset is a multiple of
+// the host page size, so the pages can be mapped straight from the file.
+// Pages that are all zero are left out.
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t pageCount;
+  uint32_t registers[17];
+  uint32_t toDecode;
+  uint32_t toExecute;
+  uint32_t decodedType;
+  uint32_t pages;
+  uint64_t dataOffset;
+};
+
+static bool isZero(const uint8_t *data) {
+  for (uint32_t i = 0; i < MEMORY_PAGE_SIZE; i++) {
+    if (data[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Collects the numbers of the pages worth storing, in address order.
+static uint32_t *storedPages(const struct State *state, uint32_t *count) {
+  uint32_t capacity = 64;
+  uint32_t *numbers = malloc(capacity * sizeof(uint32_t));
+  *count = 0;
+  for (uint32_t i = 0; numbers != NULL && i < DIRECTORY_SIZE; i++) {
+    for (uint32_t j = 0; state->pageTable[i] != NULL && j < PAGE_TABLE_SIZE;
+         j++) {
+      const uint8_t *data = state->pageTable[i][j].data;
+      if (data == NULL || isZero(data)) {
+        continue;
+      }
+      if (*count == capacity) {
+        capacity *= 2;
+        numbers = realloc(numbers, capacity * sizeof(uint32_t));
+        if (numbers == NULL) {
+          break;
+        }
+      }
+      numbers[(*count)++] = i << PAGE_TABLE_BITS | j;
+    }
+  }
+  if (numbers == NULL) {
+    perror("Error allocating the snapshot index.\n");
+    exit(EXIT_FAILURE);
+  }
+  return numbers;
+}
+
+bool machine_save(Machine *state, const char *fileName) {
+  FILE *fp = fopen(fileName, "wb");
+  if (fp == NULL) {
+    perror(fileName);
+    return false;
+  }
+
+  struct SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  strcpy(header.magic, SNAPSHOT_MAGIC);
+  header.version = SNAPSHOT_VERSION;
+  header.pageCount = state->pageCount;
+  materialiseFlags(state);
+  memcpy(header.registers, state->registers, sizeof(header.registers));
+  header.toDecode = state->toDecode;
+  header.toExecute = state->toExecute;
+  header.decodedType = state->decodedType;
+
+  uint32_t *numbers = storedPages(state, &header.pages);
+  uint64_t alignment = sysconf(_SC_PAGESIZE);
+  if (alignment < MEMORY_PAGE_SIZE) {
+    alignment = MEMORY_PAGE_SIZE;
+  }
+  uint64_t indexEnd = sizeof(header) + header.pages * sizeof(uint32_t);
+  header.dataOffset = (indexEnd + alignment - 1) / alignment * alignment;
+
+  fwrite(&header, sizeof(header), 1, fp);
+  fwrite(numbers, sizeof(uint32_t), header.pages, fp);
+  for (uint64_t i = indexEnd; i < header.dataOffset; i++) {
+    fputc(0, fp);
+  }
+  for (uint32_t i = 0; i < header.pages; i++) {
+    const struct Page *page = findPage(state, numbers[i] << MEMORY_PAGE_BITS);
+    fwrite(page->data, MEMORY_PAGE_SIZE, 1, fp);
+  }
+  free(numbers);
+
+  bool failed = ferror(fp);
+  if (failed) {
+    perror("Error writing the snapshot.\n");
+  }
+  return fclose(fp) == 0 && !failed;
+}
+
+// Puts the pipeline latches back, predecoding the two words in flight.
+static void restorePipeline(struct State *state,
+                            const struct SnapshotHeader *header) {
+  state->toExecute = header->toExecute;
+  state->toDecode = header->toDecode;
+  predecode(&state->prefetched[0], header->toExecute);
+  predecode(&state->prefetched[1], header->toDecode);
+  state->executing = &state->prefetched[0];
+  state->decoding = &state->prefetched[1];
+  state->decodedType = header->decodedType;
+}
+
+// Whether the header and page numbers describe memory a machine can have,
+// with every page inside it and in the file. Memory is only touched once
+// they are known to be.
+static bool validPages(FILE *fp, const struct SnapshotHeader *header,
+                       const uint32_t *numbers) {
+  if (header->pageCount > MACHINE_MAX_MEMORY >> MEMORY_PAGE_BITS) {
+    return false;
+  }
+  for (uint32_t i = 0; i < header->pages; i++) {
+    if (numbers[i] >= header->pageCount) {
+      return false;
+    }
+  }
+  struct stat info;
+  return fstat(fileno(fp), &info) == 0 &&
+         header->dataOffset + (uint64_t)header->pages * MEMORY_PAGE_SIZE <=
+             (uint64_t)info.st_size;
+}
+
+bool machine_restore(Machine *state, const char *fileName) {
+  FILE *fp = fopen(fileName, "rb");
+  if (fp == NULL) {
+    perror(fileName);
+    return false;
+  }
+
+  struct SnapshotHeader header;
+  uint32_t *numbers = NULL;
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+      header.version != SNAPSHOT_VERSION || header.pageCount == 0 ||
+      header.decodedType > Terminate ||
+      (numbers = malloc((header.pages + 1) * sizeof(uint32_t))) == NULL ||
+      fread(numbers, sizeof(uint32_t), header.pages, fp) != header.pages ||
+      !validPages(fp, &header, numbers)) {
+    fprintf(stderr, "%s: not a valid snapshot.\n", fileName);
+    free(numbers);
+    fclose(fp);
+    return false;
+  }
+
+  clearMemory(state);
+  state->pageCount = header.pageCount;
+  memcpy(state->registers, header.registers, sizeof(header.registers));
+  state->flags.source = Materialised;
+  restorePipeline(state, &header);
+
+  // Pages are mapped copy-on-write where the file allows it, and read in
+  // otherwise.
+  bool failed = false;
+  if (header.pages > 0 &&
+      (header.dataOffset % sysconf(_SC_PAGESIZE) != 0 ||
+       !mapPages(state, fileno(fp), header.dataOffset, numbers,
+                 header.pages))) {
+    fseek(fp, header.dataOffset, SEEK_SET);
+    for (uint32_t i = 0; i < header.pages && !failed; i++) {
+      uint8_t data[MEMORY_PAGE_SIZE];
+      failed = fread(data, MEMORY_PAGE_SIZE, 1, fp) != 1;
+      for (uint32_t j = 0; j < MEMORY_PAGE_SIZE && !failed; j += 4) {
+        uint32_t word;
+        memcpy(&word, &data[j], 4);
+        writeWord(state, numbers[i] << MEMORY_PAGE_BITS | j, word);
+      }
+    }
+    if (failed) {
+      fprintf(stderr, "%s: snapshot is truncated.\n", fileName);
+    }
+  }
+  free(numbers);
+  fclose(fp);
+  return !failed;
+}
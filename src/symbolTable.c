@@ -5,46 +5,143 @@
 #include <string.h>
 #include "symbolTable.h"
 
-void push(Node_t *head, char *key, uint32_t value) {
-  Node_t *prev = head;
-  Node_t *curr = head->next;
-  while(curr) {
-    prev = curr;
-    curr = curr->next;
-  }
-  curr = (Node_t *) malloc(sizeof(Node_t));
-  strcpy(curr->key, key);
-  curr->value = value;
-  curr->next = NULL;
-  prev->next = curr;
-}
-
-bool exists(Node_t *head, char *key) {
-  Node_t *curr = head->next;
-  while(curr) {
-    if (strcmp(curr->key, key) == 0) {
-      return true;
+#define INITIAL_CAPACITY (64)
+#define POOL_BLOCK_SIZE (65536)
+
+// Interned keys are packed into large blocks, freed all at once with the
+// table.
+struct Pool {
+  struct Pool *next;
+  size_t used;
+  size_t size;
+  char data[];
+};
+
+static void *allocate(size_t size) {
+  void *memory = calloc(1, size);
+  if (memory == NULL) {
+    perror("Error allocating the symbol table.\n");
+    exit(EXIT_FAILURE);
+  }
+  return memory;
+}
+
+// FNV-1a.
+static uint32_t hashKey(const char *key, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (uint8_t) key[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static const char *intern(SymbolTable_t *table, const char *key,
+                          size_t length) {
+  Pool_t *pool = table->pool;
+  if (pool == NULL || pool->size - pool->used < length + 1) {
+    size_t size = length + 1 > POOL_BLOCK_SIZE ? length + 1 : POOL_BLOCK_SIZE;
+    Pool_t *block = allocate(sizeof(Pool_t) + size);
+    block->size = size;
+    block->next = pool;
+    table->pool = pool = block;
+  }
+  char *copy = &pool->data[pool->used];
+  memcpy(copy, key, length + 1);
+  pool->used += length + 1;
+  return copy;
+}
+
+// Returns the slot holding a key, or the empty slot where it would go.
+static Symbol_t *findSlot(const SymbolTable_t *table, const char *key,
+                          size_t length, uint32_t hash) {
+  uint32_t slot = hash & (table->capacity - 1);
+  while (table->slots[slot].key != NULL &&
+         (table->slots[slot].hash != hash ||
+          strncmp(table->slots[slot].key, key, length) != 0 ||
+          table->slots[slot].key[length] != '\0')) {
+    slot = (slot + 1) & (table->capacity - 1);
+  }
+  return &table->slots[slot];
+}
+
+// Doubles the table once it is half full.
+static void grow(SymbolTable_t *table) {
+  Symbol_t *old = table->slots;
+  uint32_t oldCapacity = table->capacity;
+  table->capacity *= 2;
+  table->slots = allocate(table->capacity * sizeof(Symbol_t));
+  for (uint32_t i = 0; i < oldCapacity; i++) {
+    if (old[i].key != NULL) {
+      *findSlot(table, old[i].key, strlen(old[i].key), old[i].hash) = old[i];
     }
-    curr = curr->next;
   }
-  return false;
+  free(old);
 }
 
-uint32_t getValue(Node_t *head, char *key) {
-  Node_t *curr = head->next;
-  while(curr) {
-    
-    if (strcmp(curr->key, key) == 0) {
-      return curr->value;
+SymbolTable_t *newTable(void) {
+  SymbolTable_t *table = allocate(sizeof(SymbolTable_t));
+  table->capacity = INITIAL_CAPACITY;
+  table->slots = allocate(table->capacity * sizeof(Symbol_t));
+  return table;
+}
+
+void push(SymbolTable_t *table, const char *key, uint32_t value) {
+  size_t length = strlen(key);
+  uint32_t hash = hashKey(key, length);
+  Symbol_t *symbol = findSlot(table, key, length, hash);
+  if (symbol->key != NULL) {
+    return;
+  }
+  if (2 * (table->count + 1) > table->capacity) {
+    grow(table);
+    symbol = findSlot(table, key, length, hash);
+  }
+  symbol->key = intern(table, key, length);
+  symbol->hash = hash;
+  symbol->value = value;
+  table->count++;
+}
+
+bool lookup(const SymbolTable_t *table, const char *key, size_t length,
+            uint32_t *value) {
+  Symbol_t *symbol = findSlot(table, key, length, hashKey(key, length));
+  if (symbol->key == NULL) {
+    return false;
+  }
+  *value = symbol->value;
+  return true;
+}
+
+bool exists(const SymbolTable_t *table, const char *key) {
+  uint32_t value;
+  return lookup(table, key, strlen(key), &value);
+}
+
+uint32_t getValue(const SymbolTable_t *table, const char *key) {
+  uint32_t value = 0;
+  lookup(table, key, strlen(key), &value);
+  return value;
+}
+
+void forEachSymbol(const SymbolTable_t *table,
+                   void (*visit)(const Symbol_t *symbol, void *context),
+                   void *context) {
+  for (uint32_t slot = 0; slot < table->capacity; slot++) {
+    if (table->slots[slot].key != NULL) {
+      visit(&table->slots[slot], context);
     }
-    curr = curr->next;
   }
-  return 0;
 }
 
-void freeTable(Node_t *head) {
-  if(head) {
-    freeTable(head->next);
-    free(head);
+void freeTable(SymbolTable_t *table) {
+  if (table == NULL) {
+    return;
+  }
+  while (table->pool != NULL) {
+    Pool_t *next = table->pool->next;
+    free(table->pool);
+    table->pool = next;
   }
+  free(table->slots);
+  free(table);
 }
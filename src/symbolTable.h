@@ -1,19 +1,46 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-#define LINE_LENGTH (511)
+// Symbol table mapping names to values, kept as an open addressing hash
+// table. Keys are copied into a string pool owned by the table, so callers
+// may reuse their buffers.
 
-typedef struct Node {
-  char key[LINE_LENGTH + 1];
+typedef struct Symbol {
+  const char *key;
+  uint32_t hash;
   uint32_t value;
-  struct Node *next;
-} Node_t;
+} Symbol_t;
 
-void push(Node_t *head, char *key, uint32_t value);
+typedef struct Pool Pool_t;
 
-bool exists(Node_t *head, char *key);
+typedef struct SymbolTable {
+  Symbol_t *slots;
+  uint32_t capacity;
+  uint32_t count;
+  Pool_t *pool;
+} SymbolTable_t;
 
-uint32_t getValue(Node_t *head, char *key);
+SymbolTable_t *newTable(void);
 
-void freeTable(Node_t *head);
+// Adds a key, keeping the value already stored if the key is present.
+void push(SymbolTable_t *table, const char *key, uint32_t value);
+
+bool exists(const SymbolTable_t *table, const char *key);
+
+// Returns the value stored for a key, or 0 if it is not present.
+uint32_t getValue(const SymbolTable_t *table, const char *key);
+
+// Looks up a key given as a pointer and a length, which need not be
+// terminated, storing its value if it is present.
+bool lookup(const SymbolTable_t *table, const char *key, size_t length,
+            uint32_t *value);
+
+// Calls visit with every symbol in the table and the given context, in no
+// particular order. The table must not change until it returns.
+void forEachSymbol(const SymbolTable_t *table,
+                   void (*visit)(const Symbol_t *symbol, void *context),
+                   void *context);
+
+void freeTable(SymbolTable_t *table);
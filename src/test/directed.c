@@ -0,0 +1,244 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "machine.h"
+#include "utils.h"
+
+// Directed tests of the assembler and every emulator engine. Each test is a
+// short program, given as source for ./assemble or as words for encodings
+// the assembler has no syntax for, along with the registers it must leave.
+// Every program is run to its end on each engine in turn. Helpers the
+// assembler encodes with are checked directly.
+
+#define MAX_WORDS (8)
+#define MAX_CHECKS (4)
+#define CPSR (16)
+
+// The expected value of a register, 16 being the CPSR.
+struct Check {
+  bool used;
+  uint32_t reg;
+  uint32_t value;
+};
+
+#define EXPECT(reg, value) {true, (reg), (value)}
+
+struct Test {
+  const char *name;
+  const char *source;
+  uint32_t words[MAX_WORDS];
+  struct Check checks[MAX_CHECKS];
+};
+
+static const struct Test tests[] = {
+    {"asr and ror shift codes",
+     "mov r2,#0x100\n"
+     "mov r1,r2,asr #4\n"
+     "mov r3,r2,ror #12\n"
+     "andeq r0,r0,r0\n",
+     {0},
+     {EXPECT(1, 0x10), EXPECT(3, 0x10000000)}},
+    {"shifted register transfer offset",
+     "mov r1,#0x100\n"
+     "mov r2,#2\n"
+     "mov r3,#42\n"
+     "str r3,[r1,r2,lsl #2]\n"
+     "ldr r4,[r1,#8]\n"
+     "andeq r0,r0,r0\n",
+     {0},
+     {EXPECT(4, 42)}},
+    {"ldr = of a word with the top bit set",
+     "ldr r0,=0xfffffff0\n"
+     "andeq r0,r0,r0\n",
+     {0},
+     {EXPECT(0, 0xfffffff0)}},
+    {"ldr = of a word too wide for mov",
+     "ldr r0,=0x12345\n"
+     "andeq r0,r0,r0\n",
+     {0},
+     {EXPECT(0, 0x12345)}},
+    {"unsigned rotates",
+     "mov r1,#0x80000000\n"
+     "sub r2,r2,#2\n"
+     "mov r3,r2,ror #4\n"
+     "andeq r0,r0,r0\n",
+     {0},
+     {EXPECT(1, 0x80000000), EXPECT(3, 0xefffffff)}},
+    {"carry out of lsl",
+     "mov r2,#0x80000000\n"
+     "tst r1,r2,lsl #1\n"
+     "andeq r0,r0,r0\n",
+     {0},
+     {EXPECT(CPSR, 0x60000000)}},
+    {"carry kept by an unshifted register",
+     "mov r2,#2\n"
+     "cmp r1,r1\n"
+     "tst r2,r2\n"
+     "andeq r0,r0,r0\n",
+     {0},
+     {EXPECT(CPSR, 0x20000000)}},
+    {"carry kept by an unrotated immediate",
+     "mov r2,#1\n"
+     "cmp r1,r1\n"
+     "tst r2,#1\n"
+     "andeq r0,r0,r0\n",
+     {0},
+     {EXPECT(CPSR, 0x20000000)}},
+    {"unsigned carry of cmp",
+     "mov r1,#1\n"
+     "mov r3,#0x80000000\n"
+     "cmp r1,r3\n"
+     "andeq r0,r0,r0\n",
+     {0},
+     {EXPECT(CPSR, 0x80000000)}},
+    {"mul leaves the flags alone",
+     "mov r2,#2\n"
+     "mov r3,#3\n"
+     "cmp r1,r1\n"
+     "mul r4,r2,r3\n"
+     "andeq r0,r0,r0\n",
+     {0},
+     {EXPECT(4, 6), EXPECT(CPSR, 0x60000000)}},
+    {"mla accumulating into its destination",
+     "mov r1,#5\n"
+     "mov r2,#2\n"
+     "mov r3,#3\n"
+     "mla r1,r2,r3,r1\n"
+     "andeq r0,r0,r0\n",
+     {0},
+     {EXPECT(1, 11)}},
+    {"unsigned carry of adds",
+     NULL,
+     {0xe3e01000,   // mvn r1,#0
+      0xe3a02001,   // mov r2,#1
+      0xe0910002},  // adds r0,r1,r2
+     {EXPECT(0, 0), EXPECT(CPSR, 0x60000000)}},
+    {"ldr = with its pool right after it",
+     "ldr r0,=0x12345\n",
+     {0},
+     {EXPECT(0, 0x12345)}},
+};
+
+static const char *engineNames[] = {"pipeline", "fast", "jit"};
+
+// Assembles source into binary with ./assemble, returning false if it fails.
+static bool assemble(const char *source, const char *sourceName,
+                     const char *binary) {
+  FILE *fp = fopen(sourceName, "w");
+  if (fp == NULL) {
+    perror("Error writing a test program.\n");
+    exit(EXIT_FAILURE);
+  }
+  fputs(source, fp);
+  fclose(fp);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("Error starting the assembler.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    execl("./assemble", "./assemble", sourceName, binary, (char *) NULL);
+    _exit(127);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void writeWords(const uint32_t *words, const char *binary) {
+  FILE *fp = fopen(binary, "wb");
+  if (fp == NULL) {
+    perror("Error writing a test program.\n");
+    exit(EXIT_FAILURE);
+  }
+  int count = MAX_WORDS;
+  while (count > 0 && words[count - 1] == 0) {
+    count--;
+  }
+  fwrite(words, sizeof(uint32_t), count, fp);
+  fclose(fp);
+}
+
+// Runs a test on every engine, printing each register that differs.
+static bool runTest(const struct Test *test, const char *directory) {
+  char sourceName[64];
+  char binary[64];
+  snprintf(sourceName, sizeof(sourceName), "%s/test.s", directory);
+  snprintf(binary, sizeof(binary), "%s/test.bin", directory);
+  if (test->source != NULL) {
+    if (!assemble(test->source, sourceName, binary)) {
+      printf("%s: does not assemble\n", test->name);
+      return false;
+    }
+  } else {
+    writeWords(test->words, binary);
+  }
+
+  bool passed = true;
+  for (int engine = PipelineEngine; engine <= JitEngine; engine++) {
+    Machine *machine = machine_new(engine);
+    if (!machine_load(machine, binary)) {
+      fprintf(stderr, "Error loading %s.\n", binary);
+      exit(EXIT_FAILURE);
+    }
+    machine_run(machine);
+    for (int i = 0; i < MAX_CHECKS && test->checks[i].used; i++) {
+      const struct Check *check = &test->checks[i];
+      uint32_t value = machine_register(machine, check->reg);
+      if (value != check->value) {
+        char name[8] = "cpsr";
+        if (check->reg != CPSR) {
+          snprintf(name, sizeof(name), "r%u", check->reg);
+        }
+        printf("%s: %s: %s is 0x%08x, not 0x%08x\n", test->name,
+               engineNames[engine], name, value, check->value);
+        passed = false;
+      }
+    }
+    machine_free(machine);
+  }
+  return passed;
+}
+
+// Writing a value too wide for its field must leave the bits around the
+// field alone.
+static bool checkSetBits(void) {
+  uint32_t word = 0xf000000f;
+  setBits(&word, 0x1ff, 11, 8);
+  if (word != 0xf0000fff) {
+    printf("setBits: 0x%08x, not 0xf0000fff\n", word);
+    return false;
+  }
+  return true;
+}
+
+int main(void) {
+  char directory[] = "/tmp/directedXXXXXX";
+  if (mkdtemp(directory) == NULL) {
+    perror("Error creating a directory for the tests.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int programs = sizeof(tests) / sizeof(tests[0]);
+  int passed = checkSetBits();
+  for (int i = 0; i < programs; i++) {
+    passed += runTest(&tests[i], directory);
+  }
+  int count = programs + 1;
+
+  char path[64];
+  snprintf(path, sizeof(path), "%s/test.s", directory);
+  remove(path);
+  snprintf(path, sizeof(path), "%s/test.bin", directory);
+  remove(path);
+  rmdir(directory);
+
+  printf("%d of %d tests passed\n", passed, count);
+  return passed == count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,492 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emulate.h"
+#include "trace.h"
+
+#define TRACE_MAGIC ("ARMTRACE")
+#define TRACE_VERSION (1)
+#define CHUNK_RECORDS (16384)
+#define CACHE_SIZE (4096)
+
+// Flags in the byte opening each record, saying which fields follow it.
+#define RECORD_JUMP (1)
+#define RECORD_WORD (2)
+#define RECORD_MASK (4)
+#define RECORD_STORES (8)
+
+// The largest record without its stores: the flags, the jump, the word, the
+// mask and a delta for each of the 16 registers a record can change.
+#define MAX_RECORD (1 + 5 + 4 + 5 + 16 * 5 + 5)
+#define MAX_STORE (10)
+
+struct TraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t chunkRecords;
+  // Records before this index only lead up to those of interest.
+  uint64_t first;
+};
+
+struct ChunkHeader {
+  uint32_t size;
+  uint32_t records;
+  uint64_t first;
+  uint32_t pc;
+  uint32_t registers[17];
+};
+
+// The word and the registers written the last time an address ran, which
+// the writer and the reader both keep so that a record can leave them out.
+struct CacheEntry {
+  uint32_t pc;
+  uint32_t word;
+  uint32_t mask;
+};
+
+struct Chunk {
+  struct ChunkHeader header;
+  uint8_t *data;
+  size_t capacity;
+};
+
+// What the writer and the reader track between records of a chunk.
+struct Coder {
+  uint32_t registers[17];
+  uint32_t expected;
+  uint32_t lastStore;
+  struct CacheEntry cache[CACHE_SIZE];
+};
+
+struct Trace {
+  FILE *file;
+  uint64_t ring;
+  uint32_t chunkRecords;
+  // A ring of chunks, or just the one being filled when streaming.
+  struct Chunk *chunks;
+  size_t chunkCount;
+  size_t current;
+  uint64_t count;
+  bool recording;
+  uint32_t pc;
+  uint32_t word;
+  struct TraceStore *stores;
+  size_t storeCount;
+  size_t storeCapacity;
+  struct Coder coder;
+};
+
+struct TraceReader {
+  FILE *file;
+  struct TraceHeader header;
+  struct ChunkHeader chunk;
+  uint8_t *data;
+  size_t capacity;
+  size_t position;
+  uint32_t remaining;
+  uint64_t index;
+  bool failed;
+  struct TraceStore *stores;
+  size_t storeCapacity;
+  struct Coder coder;
+};
+
+static void *allocate(void *memory, size_t size) {
+  memory = realloc(memory, size);
+  if (memory == NULL) {
+    perror("Error allocating a trace.\n");
+    exit(EXIT_FAILURE);
+  }
+  return memory;
+}
+
+static uint32_t zigzag(uint32_t delta) {
+  return (delta << 1) ^ (uint32_t)-(int32_t)(delta >> 31);
+}
+
+static uint32_t unzigzag(uint32_t value) {
+  return (value >> 1) ^ -(value & 1);
+}
+
+// The CPSR only changes in its top bits, so its deltas are taken with xor
+// and rotated down to keep the varints short.
+static uint32_t registerDelta(int n, uint32_t old, uint32_t new) {
+  if (n == 16) {
+    uint32_t changed = old ^ new;
+    return changed << 4 | changed >> 28;
+  }
+  return zigzag(new - old);
+}
+
+static uint32_t applyDelta(int n, uint32_t old, uint32_t delta) {
+  if (n == 16) {
+    return old ^ (delta >> 4 | delta << 28);
+  }
+  return old + unzigzag(delta);
+}
+
+static uint8_t *writeVarint(uint8_t *out, uint32_t value) {
+  while (value >= 0x80) {
+    *out++ = value | 0x80;
+    value >>= 7;
+  }
+  *out++ = value;
+  return out;
+}
+
+static void resetCoder(struct Coder *coder, const struct ChunkHeader *header) {
+  memcpy(coder->registers, header->registers, sizeof(coder->registers));
+  coder->expected = header->pc;
+  coder->lastStore = 0;
+  memset(coder->cache, 0, sizeof(coder->cache));
+}
+
+static struct CacheEntry *cacheEntry(struct Coder *coder, uint32_t pc) {
+  return &coder->cache[(pc >> 2) & (CACHE_SIZE - 1)];
+}
+
+static void writeHeader(struct Trace *trace, uint64_t first) {
+  struct TraceHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_VERSION;
+  header.chunkRecords = trace->chunkRecords;
+  header.first = first;
+  fwrite(&header, sizeof(header), 1, trace->file);
+}
+
+static void writeChunk(struct Trace *trace, struct Chunk *chunk) {
+  if (chunk->header.records > 0) {
+    fwrite(&chunk->header, sizeof(chunk->header), 1, trace->file);
+    fwrite(chunk->data, 1, chunk->header.size, trace->file);
+  }
+}
+
+struct Trace *traceNew(FILE *file, uint64_t ring) {
+  struct Trace *trace = allocate(NULL, sizeof(struct Trace));
+  memset(trace, 0, sizeof(struct Trace));
+  trace->file = file;
+  trace->ring = ring;
+  trace->chunkRecords = CHUNK_RECORDS;
+  trace->chunkCount = 1;
+  if (ring > 0) {
+    // One chunk more than the ring needs, as the oldest is being replaced.
+    // Chunks stay full size even for short rings, since every chunk starts
+    // with a fresh cache.
+    trace->chunkCount = (ring + trace->chunkRecords - 1) /
+                        trace->chunkRecords + 1;
+  } else {
+    writeHeader(trace, 0);
+  }
+  trace->chunks = allocate(NULL, trace->chunkCount * sizeof(struct Chunk));
+  memset(trace->chunks, 0, trace->chunkCount * sizeof(struct Chunk));
+  return trace;
+}
+
+void traceFree(struct Trace *trace) {
+  if (trace == NULL) {
+    return;
+  }
+  if (trace->ring > 0) {
+    writeHeader(trace, trace->count > trace->ring ? trace->count - trace->ring
+                                                  : 0);
+    for (size_t i = 1; i <= trace->chunkCount; i++) {
+      writeChunk(trace, &trace->chunks[(trace->current + i) %
+                                       trace->chunkCount]);
+    }
+  } else {
+    writeChunk(trace, &trace->chunks[0]);
+  }
+  if (ferror(trace->file)) {
+    perror("Error writing the trace.\n");
+  }
+  fclose(trace->file);
+  for (size_t i = 0; i < trace->chunkCount; i++) {
+    free(trace->chunks[i].data);
+  }
+  free(trace->chunks);
+  free(trace->stores);
+  free(trace);
+}
+
+void traceBefore(struct Trace *trace, struct State *state) {
+  trace->recording = state->toExecute != EMPTY_LATCH;
+  if (!trace->recording) {
+    return;
+  }
+  trace->pc = state->registers[15] - 8;
+  trace->word = state->executing->word;
+  trace->storeCount = 0;
+
+  struct Chunk *chunk = &trace->chunks[trace->current];
+  if (chunk->header.records == 0) {
+    materialiseFlags(state);
+    chunk->header.size = 0;
+    chunk->header.first = trace->count;
+    chunk->header.pc = trace->pc;
+    memcpy(chunk->header.registers, state->registers,
+           sizeof(chunk->header.registers));
+    resetCoder(&trace->coder, &chunk->header);
+  }
+}
+
+// Closes the chunk once it is full, writing it out when streaming or moving
+// on to the oldest chunk of the ring.
+static void finishChunk(struct Trace *trace) {
+  struct Chunk *chunk = &trace->chunks[trace->current];
+  if (chunk->header.records < trace->chunkRecords) {
+    return;
+  }
+  if (trace->ring == 0) {
+    writeChunk(trace, chunk);
+  } else {
+    trace->current = (trace->current + 1) % trace->chunkCount;
+    chunk = &trace->chunks[trace->current];
+  }
+  chunk->header.records = 0;
+}
+
+void traceAfter(struct Trace *trace, struct State *state) {
+  if (!trace->recording) {
+    return;
+  }
+  trace->recording = false;
+  materialiseFlags(state);
+
+  struct Chunk *chunk = &trace->chunks[trace->current];
+  size_t needed = chunk->header.size + MAX_RECORD +
+                  trace->storeCount * MAX_STORE;
+  if (needed > chunk->capacity) {
+    chunk->capacity = needed > 2 * chunk->capacity ? needed
+                                                   : 2 * chunk->capacity;
+    chunk->data = allocate(chunk->data, chunk->capacity);
+  }
+
+  // Registers are compared against what the reader will have decoded, which
+  // also catches changes made between cycles.
+  struct Coder *coder = &trace->coder;
+  uint32_t mask = 0;
+  for (int i = 0; i <= 16; i++) {
+    if (i != 15 && state->registers[i] != coder->registers[i]) {
+      mask |= 1u << i;
+    }
+  }
+
+  uint8_t *start = &chunk->data[chunk->header.size];
+  uint8_t *out = start + 1;
+  uint8_t flags = 0;
+  if (trace->pc != coder->expected) {
+    flags |= RECORD_JUMP;
+    out = writeVarint(out, zigzag(trace->pc - coder->expected));
+  }
+  struct CacheEntry *entry = cacheEntry(coder, trace->pc);
+  if (entry->pc != trace->pc || entry->word != trace->word) {
+    flags |= RECORD_WORD;
+    memcpy(out, &trace->word, 4);
+    out += 4;
+  }
+  if (entry->pc != trace->pc || entry->mask != mask) {
+    flags |= RECORD_MASK;
+    out = writeVarint(out, mask);
+  }
+  entry->pc = trace->pc;
+  entry->word = trace->word;
+  entry->mask = mask;
+  for (int i = 0; i <= 16; i++) {
+    if (mask & (1u << i)) {
+      out = writeVarint(out, registerDelta(i, coder->registers[i],
+                                           state->registers[i]));
+      coder->registers[i] = state->registers[i];
+    }
+  }
+  if (trace->storeCount > 0) {
+    flags |= RECORD_STORES;
+    out = writeVarint(out, trace->storeCount);
+    for (size_t i = 0; i < trace->storeCount; i++) {
+      const struct TraceStore *store = &trace->stores[i];
+      out = writeVarint(out, zigzag(store->address - coder->lastStore));
+      out = writeVarint(out, store->value);
+      coder->lastStore = store->address;
+    }
+  }
+  *start = flags;
+  coder->expected = trace->pc + 4;
+
+  chunk->header.size = out - chunk->data;
+  chunk->header.records++;
+  trace->count++;
+  finishChunk(trace);
+}
+
+void traceStore(struct Trace *trace, uint32_t address, uint32_t value) {
+  if (!trace->recording) {
+    return;
+  }
+  if (trace->storeCount == trace->storeCapacity) {
+    trace->storeCapacity = trace->storeCapacity == 0 ? 4
+                                                     : 2 * trace->storeCapacity;
+    trace->stores = allocate(trace->stores,
+                             trace->storeCapacity * sizeof(struct TraceStore));
+  }
+  trace->stores[trace->storeCount].address = address;
+  trace->stores[trace->storeCount].value = value;
+  trace->storeCount++;
+}
+
+struct TraceReader *traceOpen(const char *fileName) {
+  FILE *file = fopen(fileName, "rb");
+  if (file == NULL) {
+    perror(fileName);
+    return NULL;
+  }
+  struct TraceReader *reader = allocate(NULL, sizeof(struct TraceReader));
+  memset(reader, 0, sizeof(struct TraceReader));
+  reader->file = file;
+  if (fread(&reader->header, sizeof(reader->header), 1, file) != 1 ||
+      memcmp(reader->header.magic, TRACE_MAGIC, 8) != 0 ||
+      reader->header.version != TRACE_VERSION) {
+    fprintf(stderr, "%s: not a trace file.\n", fileName);
+    traceClose(reader);
+    return NULL;
+  }
+  return reader;
+}
+
+// Moves on to the next chunk, returning false at the end of the file.
+static bool readChunk(struct TraceReader *reader) {
+  struct ChunkHeader *chunk = &reader->chunk;
+  if (fread(chunk, sizeof(*chunk), 1, reader->file) != 1) {
+    return false;
+  }
+  if (chunk->size > reader->capacity) {
+    reader->capacity = chunk->size;
+    reader->data = allocate(reader->data, reader->capacity);
+  }
+  if (fread(reader->data, 1, chunk->size, reader->file) != chunk->size) {
+    reader->failed = true;
+    return false;
+  }
+  reader->position = 0;
+  reader->remaining = chunk->records;
+  reader->index = chunk->first;
+  resetCoder(&reader->coder, chunk);
+  return true;
+}
+
+static uint32_t readVarint(struct TraceReader *reader) {
+  uint32_t value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (reader->position >= reader->chunk.size) {
+      reader->failed = true;
+      return 0;
+    }
+    uint8_t byte = reader->data[reader->position++];
+    value |= (uint32_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  reader->failed = true;
+  return 0;
+}
+
+static bool decodeRecord(struct TraceReader *reader,
+                         struct TraceRecord *record) {
+  struct Coder *coder = &reader->coder;
+  if (reader->position >= reader->chunk.size) {
+    reader->failed = true;
+    return false;
+  }
+  uint8_t flags = reader->data[reader->position++];
+
+  uint32_t pc = coder->expected;
+  if (flags & RECORD_JUMP) {
+    pc += unzigzag(readVarint(reader));
+  }
+  struct CacheEntry *entry = cacheEntry(coder, pc);
+  if (entry->pc != pc) {
+    entry->pc = pc;
+    entry->word = 0;
+    entry->mask = 0;
+  }
+  if (flags & RECORD_WORD) {
+    if (reader->position + 4 > reader->chunk.size) {
+      reader->failed = true;
+      return false;
+    }
+    memcpy(&entry->word, &reader->data[reader->position], 4);
+    reader->position += 4;
+  }
+  if (flags & RECORD_MASK) {
+    entry->mask = readVarint(reader);
+  }
+  for (int i = 0; i <= 16; i++) {
+    if (entry->mask & (1u << i)) {
+      coder->registers[i] =
+          applyDelta(i, coder->registers[i], readVarint(reader));
+    }
+  }
+
+  record->storeCount = 0;
+  if (flags & RECORD_STORES) {
+    uint32_t count = readVarint(reader);
+    if (count > reader->chunk.size) {
+      reader->failed = true;
+      return false;
+    }
+    if (count > reader->storeCapacity) {
+      reader->storeCapacity = count;
+      reader->stores = allocate(reader->stores,
+                                count * sizeof(struct TraceStore));
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      coder->lastStore += unzigzag(readVarint(reader));
+      reader->stores[i].address = coder->lastStore;
+      reader->stores[i].value = readVarint(reader);
+    }
+    record->storeCount = count;
+  }
+  coder->expected = pc + 4;
+
+  record->index = reader->index++;
+  record->pc = pc;
+  record->word = entry->word;
+  record->changed = entry->mask;
+  memcpy(record->registers, coder->registers, sizeof(record->registers));
+  record->registers[15] = pc + 8;
+  record->stores = reader->stores;
+  return !reader->failed;
+}
+
+bool traceNext(struct TraceReader *reader, struct TraceRecord *record) {
+  while (!reader->failed) {
+    if (reader->remaining == 0) {
+      if (!readChunk(reader)) {
+        return false;
+      }
+      continue;
+    }
+    reader->remaining--;
+    if (!decodeRecord(reader, record)) {
+      return false;
+    }
+    if (record->index >= reader->header.first) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool traceFailed(const struct TraceReader *reader) {
+  return reader->failed;
+}
+
+void traceClose(struct TraceReader *reader) {
+  fclose(reader->file);
+  free(reader->data);
+  free(reader->stores);
+  free(reader);
+}
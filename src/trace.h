@@ -0,0 +1,63 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Execution traces: a record of every instruction a machine ran, with the
+// registers it changed and the words it stored.
+//
+// A trace file is a header followed by chunks of records. Each chunk opens
+// with the registers at its first instruction, so it can be decoded on its
+// own, and every record after that holds only what changed: the pc as a
+// jump from the next address, the instruction word and the set of
+// registers written unless they are the same as the last time the address
+// ran, the register deltas as varints, and the stores.
+
+struct State;
+struct Trace;
+
+// Starts a trace into a file opened for writing. With a ring of 0 every
+// instruction is streamed to the file, otherwise only the last ring are
+// kept in memory and written out when the trace is freed.
+struct Trace *traceNew(FILE *file, uint64_t ring);
+
+// Writes out whatever is buffered and closes the file.
+void traceFree(struct Trace *trace);
+
+// Bracket a pipeline cycle, recording the instruction it executes.
+void traceBefore(struct Trace *trace, struct State *state);
+
+void traceAfter(struct Trace *trace, struct State *state);
+
+void traceStore(struct Trace *trace, uint32_t address, uint32_t value);
+
+struct TraceStore {
+  uint32_t address;
+  uint32_t value;
+};
+
+// One decoded instruction: where it ran, the registers it changed, with bit
+// 16 of the mask for the CPSR, the registers afterwards and its stores.
+struct TraceRecord {
+  uint64_t index;
+  uint32_t pc;
+  uint32_t word;
+  uint32_t changed;
+  uint32_t registers[17];
+  size_t storeCount;
+  const struct TraceStore *stores;
+};
+
+struct TraceReader;
+
+// Opens a trace file, returning NULL if it cannot be read or is not a trace.
+struct TraceReader *traceOpen(const char *fileName);
+
+// Decodes the next record, returning false at the end of the trace. The
+// stores stay valid until the next call.
+bool traceNext(struct TraceReader *reader, struct TraceRecord *record);
+
+// Whether the trace ended early because it was truncated or corrupt.
+bool traceFailed(const struct TraceReader *reader);
+
+void traceClose(struct TraceReader *reader);
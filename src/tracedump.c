@@ -0,0 +1,154 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+// Prints an execution trace recorded with emulate --trace as text, one
+// instruction per line, optionally only the instructions matching a search.
+
+// What to look for. Every search given has to match.
+struct Search {
+  uint64_t from;
+  uint64_t to;
+  bool byPc;
+  uint32_t pc;
+  bool byWord;
+  uint32_t word;
+  bool byStore;
+  uint32_t store;
+  int reg;
+  uint32_t value;
+  bool registers;
+};
+
+bool matches(const struct Search *search, const struct TraceRecord *record) {
+  if (record->index < search->from || record->index > search->to) {
+    return false;
+  }
+  if (search->byPc && record->pc != search->pc) {
+    return false;
+  }
+  if (search->byWord && record->word != search->word) {
+    return false;
+  }
+  if (search->reg >= 0 &&
+      (!(record->changed & (1u << search->reg)) ||
+       record->registers[search->reg] != search->value)) {
+    return false;
+  }
+  if (search->byStore) {
+    for (size_t i = 0; i < record->storeCount; i++) {
+      if (record->stores[i].address == search->store) {
+        return true;
+      }
+    }
+    return false;
+  }
+  return true;
+}
+
+void printRecord(const struct TraceRecord *record, bool registers) {
+  printf("%10llu 0x%08x: 0x%08x", (unsigned long long)record->index,
+         record->pc, record->word);
+  for (int i = 0; i <= 16; i++) {
+    if (record->changed & (1u << i)) {
+      if (i == 16) {
+        printf(" cpsr=0x%08x", record->registers[i]);
+      } else {
+        printf(" r%d=0x%08x", i, record->registers[i]);
+      }
+    }
+  }
+  for (size_t i = 0; i < record->storeCount; i++) {
+    printf(" [0x%08x]=0x%08x", record->stores[i].address,
+           record->stores[i].value);
+  }
+  printf("\n");
+  if (registers) {
+    for (int i = 0; i <= 16; i++) {
+      char name[5];
+      snprintf(name, sizeof(name), i == 16 ? "cpsr" : "r%d", i);
+      printf("%s %4s=0x%08x%s", i % 4 == 0 ? "          " : "", name,
+             record->registers[i], i % 4 == 3 || i == 16 ? "\n" : "");
+    }
+  }
+}
+
+// Parses a register name, r0 to r15 or cpsr, returning -1 if it is not one.
+int parseRegister(const char *name) {
+  if (strcmp(name, "cpsr") == 0 || strcmp(name, "CPSR") == 0) {
+    return 16;
+  }
+  if (name[0] != 'r' && name[0] != 'R') {
+    return -1;
+  }
+  char *end;
+  long n = strtol(name + 1, &end, 10);
+  return *end == '\0' && name[1] != '\0' && n >= 0 && n <= 15 ? n : -1;
+}
+
+int main(int argc, char *argv[]) {
+  // --pc, --word and --store take an address or word, --reg a register
+  // name and the value it is set to, and --from and --to bound the
+  // instruction indices. --registers prints the whole register file after
+  // each instruction shown.
+  struct Search search = {.to = UINT64_MAX, .reg = -1};
+  const char *fileName = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--pc") == 0 && i + 1 < argc) {
+      search.byPc = true;
+      search.pc = strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--word") == 0 && i + 1 < argc) {
+      search.byWord = true;
+      search.word = strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--store") == 0 && i + 1 < argc) {
+      search.byStore = true;
+      search.store = strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--reg") == 0 && i + 2 < argc) {
+      search.reg = parseRegister(argv[++i]);
+      search.value = strtoul(argv[++i], NULL, 0);
+      if (search.reg < 0 || search.reg == 15) {
+        fprintf(stderr, "%s: not a register the trace records.\n", argv[i - 1]);
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+      search.from = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--to") == 0 && i + 1 < argc) {
+      search.to = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--registers") == 0) {
+      search.registers = true;
+    } else if (fileName == NULL) {
+      fileName = argv[i];
+    } else {
+      fileName = NULL;
+      break;
+    }
+  }
+  if (fileName == NULL) {
+    fprintf(stderr, "Usage: tracedump [--pc ADDRESS] [--word WORD] "
+                    "[--store ADDRESS] [--reg REGISTER VALUE] [--from N] "
+                    "[--to N] [--registers] TRACE\n");
+    exit(EXIT_FAILURE);
+  }
+
+  struct TraceReader *reader = traceOpen(fileName);
+  if (reader == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  struct TraceRecord record;
+  while (traceNext(reader, &record) && record.index <= search.to) {
+    if (matches(&search, &record)) {
+      printRecord(&record, search.registers);
+    }
+  }
+  bool failed = traceFailed(reader);
+  traceClose(reader);
+  if (failed) {
+    fprintf(stderr, "%s: trace is truncated.\n", fileName);
+    exit(EXIT_FAILURE);
+  }
+  return EXIT_SUCCESS;
+}
@@ -22,24 +22,9 @@ uint32_t subByte(uint32_t instruction, int start, int numBits) {
   return (instruction >> (start - numBits + 1)) & ((1 << numBits) - 1);
 }
 
-// Utility function to read a portion of the 32bit instruction
-// and outputs int in Binary representation suitable for use in switch cases.
-// E.g. 12 => 1100
-uint32_t subBinary(uint32_t instruction, int start, int numBits) {
-  instruction = subByte(instruction, start, numBits);
-  uint32_t sum = 0;
-  int base = 1;
-  for ( ; instruction > 0; instruction /= 2) {
-    int rem = instruction % 2;
-    sum += rem * base;
-    base *= 10;
-  }
-  return sum;
-}
-
 // Shift operations.
 int32_t logicalLeft(int32_t contents, uint32_t shiftAmount) {
-  return contents << shiftAmount;
+  return (uint32_t) contents << shiftAmount;
 }
 
 int32_t logicalRight(int32_t contents, uint32_t shiftAmount) {
@@ -50,12 +35,23 @@ int32_t arithmeticRight(int32_t contents, uint32_t shiftAmount) {
   return contents >> shiftAmount;
 }
 
+// Rotations work on the bits as unsigned, and by 0 leave them alone.
 int32_t rotateRight(int32_t contents, uint32_t shiftAmount) {
-  return (contents >> shiftAmount) | (contents << (BUS_WIDTH - shiftAmount));
+  uint32_t bits = contents;
+  shiftAmount %= BUS_WIDTH;
+  if (shiftAmount == 0) {
+    return bits;
+  }
+  return (bits >> shiftAmount) | (bits << (BUS_WIDTH - shiftAmount));
 }
 
 int32_t rotateLeft(int32_t contents, uint32_t shiftAmount) {
-  return (contents << shiftAmount) | (contents >> (BUS_WIDTH - shiftAmount));
+  uint32_t bits = contents;
+  shiftAmount %= BUS_WIDTH;
+  if (shiftAmount == 0) {
+    return bits;
+  }
+  return (bits << shiftAmount) | (bits >> (BUS_WIDTH - shiftAmount));
 }
 
 bool carryOut(int32_t contents, uint32_t shiftAmount, uint32_t type) {
@@ -63,7 +59,7 @@ bool carryOut(int32_t contents, uint32_t shiftAmount, uint32_t type) {
   if (type > 0) {
     return bit(contents, shiftAmount - 1);
   } else {
-    return bit(contents, 31 - shiftAmount);
+    return bit(contents, BUS_WIDTH - shiftAmount);
   }
 }
 
@@ -77,38 +73,36 @@ uint32_t shift(int32_t contents, uint32_t shiftAmount, uint32_t type){
 
 // Utility Functions for Assembler.
 
-// Utility function to tokenize the operands with delimeters ' ' and ','.
-// Assumed that max number of operands is 6, and max length of each operand is 20.
-// First element returned is the opcode (e.g. mov) followed by the operands.
-void tokenize(char *instruction, char result[6][20]) {
-  char buffer[strlen(instruction) + 1];
-  memset(result, '\0', sizeof(char) * 6 * 20);
-  strcpy(buffer, instruction);
-  char *token = strtok(buffer, " ,");
-  int tokenNo = 0;
-  while (token != NULL) {
-    strcpy(result[tokenNo], token);
-    token = strtok(NULL, " ,");
-    tokenNo++;
-  }
-}
-
 // Utility function to setBits within each uint32_t instruction to value.
 // Usage similar to subByte where you pass in the start position as indicated
 // on the specifications, and the number of bits you wish to write to.
 // Warning: when passing value, pass as normal int (e.g. 14) not as binary (e.g. 1110).
+// Bits of value that do not fit in the field are dropped.
 void setBits(uint32_t *instruction, uint32_t value, int start, int numBits) {
-  *instruction &= ~(((1 << numBits) - 1) << (start + 1 - numBits));
-  *instruction |= value << (start + 1 - numBits);
+  uint32_t mask = (1u << numBits) - 1;
+  *instruction &= ~(mask << (start + 1 - numBits));
+  *instruction |= (value & mask) << (start + 1 - numBits);
 }
 
-
-// Utility function to convert the operand string and extract the int value.
-uint32_t getRegister(char *operand) {
-  uint32_t registerInt = operand[1] - '0';
-  if (registerInt > 16) {
-    perror("Register not available");
-    exit(EXIT_FAILURE);
+// Finds the 8 bit immediate and even right rotation that make value, as the
+// 12 bits of Operand2 with half the rotation above the immediate, returning
+// false if there are none. The rotation is read off the lowest set bit, with
+// the value as it is and then turned half way round, for constants whose
+// bits wrap around from bit 31 to bit 0.
+bool encodeImmediate(uint32_t value, uint32_t *operand2) {
+  if (value < 256) {
+    *operand2 = value;
+    return true;
+  }
+  for (uint32_t turn = 0; turn < BUS_WIDTH; turn += BUS_WIDTH / 2) {
+    uint32_t turned = rotateRight(value, turn);
+    uint32_t lowest = __builtin_ctz(turned) & ~1u;
+    uint32_t immediate = rotateRight(turned, lowest);
+    if (immediate < 256) {
+      uint32_t rotation = (2 * BUS_WIDTH - lowest - turn) % BUS_WIDTH;
+      *operand2 = rotation / 2 << 8 | immediate;
+      return true;
+    }
   }
-  return registerInt;
+  return false;
 }
@@ -9,8 +9,6 @@ bool bit(uint32_t instruction, int pos);
 
 uint32_t subByte(uint32_t instruction, int start, int numBits);
 
-uint32_t subBinary(uint32_t instruction, int start, int numBits);
-
 int32_t logicalLeft(int32_t contents, uint32_t shiftAmount);
 
 int32_t logicalRight(int32_t contents, uint32_t shiftAmount);
@@ -29,8 +27,6 @@ uint32_t shift(int32_t contents, uint32_t shiftAmount, uint32_t type);
 
 // Utility Functions for Assembler.
 
-void tokenize(char *instruction, char result[6][20]);
-
 void setBits(uint32_t *instruction, uint32_t value, int start, int numBits);
 
-uint32_t getRegister(char *operand);
\ No newline at end of file
+bool encodeImmediate(uint32_t value, uint32_t *operand2);
\ No newline at end of file